@@ -27,11 +27,13 @@
 #include <QtQml/QQmlExtensionPlugin>
 #include <QtQml/QQmlEngine>
 #include <QtQml/QQmlContext>
+#include <QtQml/QQmlInfo>
 #include <QtQml/QQmlParserStatus>
 #include <QtQml/qqml.h>
 
 #include <QtRemoteModel/QRemoteModelServer>
 #include <QtRemoteModel/QRemoteModelClient>
+#include <QtRemoteModel/QRemoteModelRelay>
 
 class RemoteModelServer : public QRemoteModelServer, public QQmlParserStatus
 {
@@ -39,6 +41,8 @@ class RemoteModelServer : public QRemoteModelServer, public QQmlParserStatus
     Q_PROPERTY(QVariant model MEMBER model NOTIFY modelChanged)
     Q_PROPERTY(SpecialAddress address MEMBER address NOTIFY addressChanged)
     Q_PROPERTY(int port MEMBER port NOTIFY portChanged)
+    // a local socket on this host instead of address and port
+    Q_PROPERTY(QString name MEMBER name NOTIFY nameChanged)
     Q_ENUMS(SpecialAddress)
     Q_INTERFACES(QQmlParserStatus)
 public:
@@ -60,18 +64,23 @@ public:
     void componentComplete() {
         QAbstractItemModel *m = qvariant_cast<QAbstractItemModel *>(model);
         setModel(m);
-        listen(static_cast<QHostAddress::SpecialAddress>(address), port);
+        if (!name.isEmpty())
+            listen(name);
+        else
+            listen(static_cast<QHostAddress::SpecialAddress>(address), port);
     }
 
 signals:
     void modelChanged(const QVariant &model);
     void addressChanged(SpecialAddress address);
     void portChanged(int port);
+    void nameChanged(const QString &name);
 
 private:
     QVariant model;
     SpecialAddress address;
     int port;
+    QString name;
 };
 
 class RemoteModelClient : public QRemoteModelClient, public QQmlParserStatus
@@ -79,6 +88,8 @@ class RemoteModelClient : public QRemoteModelClient, public QQmlParserStatus
     Q_OBJECT
     Q_PROPERTY(SpecialAddress address MEMBER address NOTIFY addressChanged)
     Q_PROPERTY(int port MEMBER port NOTIFY portChanged)
+    // a local socket on this host instead of address and port
+    Q_PROPERTY(QString name MEMBER name NOTIFY nameChanged)
     Q_ENUMS(SpecialAddress)
     Q_INTERFACES(QQmlParserStatus)
 public:
@@ -98,16 +109,103 @@ public:
     {}
     void classBegin() {}
     void componentComplete() {
-        connectToHost(static_cast<QHostAddress::SpecialAddress>(address), port);
+        if (!name.isEmpty())
+            connectToServer(name);
+        else
+            connectToHost(static_cast<QHostAddress::SpecialAddress>(address), port);
     }
 
 signals:
     void addressChanged(SpecialAddress address);
     void portChanged(int port);
+    void nameChanged(const QString &name);
 
 private:
     SpecialAddress address;
     int port;
+    QString name;
+};
+
+class RemoteModelRelay : public QRemoteModelRelay, public QQmlParserStatus
+{
+    Q_OBJECT
+    Q_PROPERTY(SpecialAddress upstreamAddress MEMBER upstreamAddress NOTIFY upstreamAddressChanged)
+    Q_PROPERTY(int upstreamPort MEMBER upstreamPort NOTIFY upstreamPortChanged)
+    Q_PROPERTY(QString upstreamName MEMBER upstreamName NOTIFY upstreamNameChanged)
+    Q_PROPERTY(SpecialAddress address MEMBER address NOTIFY addressChanged)
+    Q_PROPERTY(int port MEMBER port NOTIFY portChanged)
+    Q_PROPERTY(QString name MEMBER name NOTIFY nameChanged)
+    Q_ENUMS(SpecialAddress)
+    Q_INTERFACES(QQmlParserStatus)
+public:
+    enum SpecialAddress {
+        Null = QHostAddress::Null,
+        Broadcast = QHostAddress::Broadcast,
+        LocalHost = QHostAddress::LocalHost,
+        LocalHostIPv6 = QHostAddress::LocalHostIPv6,
+        Any = QHostAddress::Any,
+        AnyIPv6 = QHostAddress::AnyIPv6,
+        AnyIPv4 = QHostAddress::AnyIPv4
+    };
+    RemoteModelRelay(QObject *parent = 0)
+        : QRemoteModelRelay(parent)
+        , upstreamAddress(LocalHost)
+        , upstreamPort(0)
+        , address(LocalHost)
+        , port(7174)
+    {}
+    void classBegin() {}
+    // listens first, the clients get the mirror once it arrived; the
+    // upstream server has no default, it must not be the relay itself
+    void componentComplete() {
+        if (upstreamName.isEmpty() && upstreamPort <= 0) {
+            qmlInfo(this) << "no upstream server set";
+            return;
+        }
+        if (loopsBack()) {
+            qmlInfo(this) << "the upstream server is the relay itself";
+            return;
+        }
+        bool listening;
+        if (!name.isEmpty())
+            listening = downstream()->listen(name);
+        else
+            listening = downstream()->listen(static_cast<QHostAddress::SpecialAddress>(address), port);
+        if (!listening)
+            qmlInfo(this) << "cannot listen on " << (name.isEmpty() ? QString::number(port) : name);
+        if (!upstreamName.isEmpty())
+            upstream()->connectToServer(upstreamName);
+        else
+            upstream()->connectToHost(static_cast<QHostAddress::SpecialAddress>(upstreamAddress), upstreamPort);
+    }
+
+signals:
+    void upstreamAddressChanged(SpecialAddress upstreamAddress);
+    void upstreamPortChanged(int upstreamPort);
+    void upstreamNameChanged(const QString &upstreamName);
+    void addressChanged(SpecialAddress address);
+    void portChanged(int port);
+    void nameChanged(const QString &name);
+
+private:
+    bool loopsBack() const {
+        if (!upstreamName.isEmpty() || !name.isEmpty())
+            return upstreamName == name;
+        if (upstreamPort != port)
+            return false;
+        // a relay listening on any address takes the connections to
+        // this host as well
+        return upstreamAddress == address
+                || ((upstreamAddress == LocalHost || upstreamAddress == LocalHostIPv6)
+                    && (address == Any || address == AnyIPv4 || address == AnyIPv6));
+    }
+
+    SpecialAddress upstreamAddress;
+    int upstreamPort;
+    QString upstreamName;
+    SpecialAddress address;
+    int port;
+    QString name;
 };
 
 class QmlRemoteModel : public QQmlExtensionPlugin
@@ -121,6 +219,7 @@ public:
         // @uri QtRemoteModel
         qmlRegisterType<RemoteModelServer>(uri, 0, 1, "RemoteModelServer");
         qmlRegisterType<RemoteModelClient>(uri, 0, 1, "RemoteModelClient");
+        qmlRegisterType<RemoteModelRelay>(uri, 0, 1, "RemoteModelRelay");
     }
 };
 
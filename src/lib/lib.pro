@@ -6,12 +6,21 @@ load(qt_module)
 
 HEADERS = qtremotemodel_global.h \
     qremotemodelserver.h \
-    qremotemodelclient.h
+    qremotemodelclient.h \
+    qremotemodelrelay.h \
+    qremotemodelprotocol_p.h \
+    qremotemodelrowindex_p.h
 
 SOURCES = qtremotemodel_global.cpp \
     qremotemodelserver.cpp \
-    qremotemodelclient.cpp
+    qremotemodelclient.cpp \
+    qremotemodelrelay.cpp \
+    qremotemodelprotocol.cpp \
+    qremotemodelrowindex.cpp
 
 DEFINES += QTREMOTEMODEL_LIBRARY
 
+qtConfig(system-zlib): QMAKE_USE_PRIVATE += zlib
+else: QT_PRIVATE += zlib-private
+
 CONFIG -= create_cmake
@@ -25,65 +25,444 @@
  */
 
 #include "qremotemodelclient.h"
+#include "qremotemodelprotocol_p.h"
+#include "qremotemodelrowindex_p.h"
 
 #include <QtCore/QCoreApplication>
+#include <QtCore/QPoint>
+#include <QtCore/QPointer>
+#include <QtCore/QSet>
+#include <QtCore/QSharedMemory>
 #include <QtCore/QSize>
-#include <QtCore/QEventLoop>
-#include <QtCore/QUuid>
 
+#include <climits>
+
+#include <QtNetwork/QLocalSocket>
 #include <QtNetwork/QTcpSocket>
 
-class Node
+#include <functional>
+
+class Node;
+class Row;
+
+// the rows with cached values, least recently used first, and their
+// estimated size; the oldest ones go once the size exceeds the budget
+class ValueCache
+{
+public:
+    ValueCache()
+        : budget(64 * 1024 * 1024), first(Q_NULLPTR), last(Q_NULLPTR), size(0), rows(0)
+        , hits(0), misses(0), evictions(0) {}
+
+    // links or relinks row at the end and counts its size again
+    void insert(Row *row);
+    void touch(Row *row);
+    void recount(Row *row);
+    void unlink(Row *row);
+    // evicts old rows until the size fits, keeping keep and everything after it
+    void trim(const Row *keep);
+    void hit(Row *row) { hits++; touch(row); }
+    void miss() { misses++; }
+
+    QVariantMap statistics() const;
+
+    qint64 budget;
+
+private:
+    Row *first;
+    Row *last;
+    qint64 size;
+    int rows;
+    qint64 hits;
+    qint64 misses;
+    qint64 evictions;
+};
+
+// what is known about one cell; only allocated once something is cached
+class Cell
 {
 public:
-    Node() : row(-1), column(-1), parent(Q_NULLPTR) {}
-    Node(int row, int column, Node *parent = Q_NULLPTR)
-        : row(row), column(column), parent(parent) {
-        if (parent)
-            parent->children.append(this);
+    Cell() : node(Q_NULLPTR), flags(-1), flagsPending(false) {}
+
+    // values received from the server, and roles whose request is still on the wire
+    QHash<int, QVariant> values;
+    QSet<int> pendingRoles;
+    // the children, for cells which have any
+    Node *node;
+    int flags;
+    bool flagsPending;
+};
+
+// one row below a parent, positioned by QRemoteModelRowIndex; a row
+// nobody looked at has no record at all, it is a virtual row of the index
+class Row : public QRemoteModelRowIndex::Item
+{
+public:
+    explicit Row(Node *parent)
+        : parent(parent), cache(Q_NULLPTR), previous(Q_NULLPTR), next(Q_NULLPTR), cost(0) {}
+    ~Row();
+
+    Cell *cell(int column) {
+        if (column >= cells.count())
+            cells.resize(column + 1);
+        return &cells[column];
+    }
+    const Cell *constCell(int column) const {
+        return column < cells.count() ? &cells.at(column) : Q_NULLPTR;
+    }
+    Node *node(int column) const {
+        return column < cells.count() ? cells.at(column).node : Q_NULLPTR;
     }
+    bool hasNodes() const {
+        foreach (const Cell &cell, cells) {
+            if (cell.node)
+                return true;
+        }
+        return false;
+    }
+
+    // grows on demand up to the column count of the parent
+    QVector<Cell> cells;
+    Node *parent;
+
+    // the place in the value cache, if the row is in there
+    ValueCache *cache;
+    Row *previous;
+    Row *next;
+    qint64 cost;
+};
+
+// a cell with children, or the root
+class Node
+{
+public:
+    // the root starts empty and unfetched; a branch is hinted by the
+    // server and its rows are fetched later
+    Node(Node *parent = Q_NULLPTR, Row *rowRecord = Q_NULLPTR, int column = -1)
+        : parent(parent), rowRecord(rowRecord), column(column), columnCount(0), handle(0)
+        , fetched(false), fetching(false), hasChildrenHint(false), canFetchMore(false) {}
     ~Node() {
-        if (parent)
-            parent->children.removeOne(this);
-        qDeleteAll(children);
+        foreach (QRemoteModelRowIndex::Item *item, rows.take(0, rows.count()))
+            delete static_cast<Row *>(item);
     }
 
+    // walks the whole subtree, so structural updates only call it when
+    // QT_REMOTEMODEL_CHECK is set in the environment
     void check(const char *func, int line) const {
-        if (children.isEmpty()) return;
+        static const bool enabled = qEnvironmentVariableIntValue("QT_REMOTEMODEL_CHECK") > 0;
+        if (enabled && !isConsistent())
+            qFatal("%s:%d: inconsistent model mirror", func, line);
+    }
 
-        std::sort(children.begin(), children.end(), [](const Node *a, const Node *b) {
-            if (a->row == b->row)
-                return a->column < b->column;
-            return a->row < b->row;
-        });
+    bool isConsistent() const {
+        if (!rows.check())
+            return false;
+        foreach (Row *r, rowRecords(0, rows.count())) {
+            if (r->cells.count() > columnCount)
+                return false;
+            for (int column = 0; column < r->cells.count(); column++) {
+                const Node *node = r->cells.at(column).node;
+                if (!node)
+                    continue;
+                if (node->rowRecord != r || node->column != column || node->parent != this || !node->isConsistent())
+                    return false;
+            }
+        }
+        return true;
+    }
 
-        bool valid = true;
-        if (children.count() != (children.last()->row + 1) * (children.last()->column + 1))
-            valid = false;
+    int row() const {
+        return parent ? parent->rows.positionOf(rowRecord) : -1;
+    }
 
-        foreach (const Node *node, children) {
-            qDebug() << node->row << node->column << node;
+    // null for a row without record, unless create is set
+    Row *rowAt(int row, bool create = false) {
+        Row *r = static_cast<Row *>(rows.at(row));
+        if (!r && create && row >= 0 && row < rows.count()) {
+            r = new Row(this);
+            rows.take(row, 1);
+            rows.insert(row, r);
         }
-        if (valid) {
-            foreach (const Node *node, children) {
-                node->check(func, line);
-            }
-        } else {
-            qDebug() << func << line;
-            Q_UNREACHABLE();
+        return r;
+    }
+
+    // the rows from first on, creating the missing records
+    QVector<Row *> rowRange(int first, int count) {
+        QVector<QRemoteModelRowIndex::Item *> items = rows.mid(first, count);
+        for (int i = 0; i < items.count(); i++) {
+            if (items.at(i))
+                continue;
+            int n = 1;
+            while (i + n < items.count() && !items.at(i + n))
+                n++;
+            QVector<QRemoteModelRowIndex::Item *> created;
+            for (int j = 0; j < n; j++)
+                created.append(items[i + j] = new Row(this));
+            rows.take(first + i, n);
+            rows.insert(first + i, created);
+            i += n - 1;
+        }
+        QVector<Row *> ret;
+        ret.reserve(items.count());
+        foreach (QRemoteModelRowIndex::Item *item, items)
+            ret.append(static_cast<Row *>(item));
+        return ret;
+    }
+
+    // only the rows which have a record
+    QVector<Row *> rowRecords(int first, int count, QVector<int> *positions = Q_NULLPTR) const {
+        QVector<Row *> ret;
+        foreach (QRemoteModelRowIndex::Item *item, rows.items(first, count, positions))
+            ret.append(static_cast<Row *>(item));
+        return ret;
+    }
+
+    // the node of a cell with children, created when create is set
+    Node *child(int row, int column, bool create = false) {
+        if (column < 0 || column >= columnCount)
+            return Q_NULLPTR;
+        Row *r = rowAt(row, create);
+        if (!r)
+            return Q_NULLPTR;
+        if (!create)
+            return r->node(column);
+        Cell *cell = r->cell(column);
+        if (!cell->node)
+            cell->node = new Node(this, r, column);
+        return cell->node;
+    }
+
+    // new rows are virtual until something is known about them
+    void insertRows(int first, int count) {
+        rows.insertVirtual(first, count);
+    }
+
+    void removeRows(int first, int count) {
+        foreach (QRemoteModelRowIndex::Item *item, rows.take(first, count))
+            delete static_cast<Row *>(item);
+    }
+
+    // the records of rows leaving for another place, null for virtual rows
+    QVector<QRemoteModelRowIndex::Item *> takeRows(int first, int count) {
+        QVector<QRemoteModelRowIndex::Item *> ret = rows.mid(first, count);
+        rows.take(first, count);
+        return ret;
+    }
+
+    void insertRows(int first, const QVector<QRemoteModelRowIndex::Item *> &items) {
+        for (int i = 0; i < items.count();) {
+            int n = 1;
+            while (i + n < items.count() && !items.at(i + n) == !items.at(i))
+                n++;
+            if (items.at(i))
+                rows.insert(first + i, items.mid(i, n));
+            else
+                rows.insertVirtual(first + i, n);
+            i += n;
+        }
+    }
+
+    void insertColumns(int first, int count) {
+        foreach (Row *r, rowRecords(0, rows.count())) {
+            if (r->cells.count() <= first)
+                continue;
+            r->cells.insert(first, count, Cell());
+            renumber(r, first + count);
+        }
+        columnCount += count;
+    }
+
+    void removeColumns(int first, int count) {
+        foreach (Row *r, rowRecords(0, rows.count())) {
+            if (r->cells.count() <= first)
+                continue;
+            int n = qMin(count, r->cells.count() - first);
+            for (int column = first; column < first + n; column++)
+                delete r->cells.at(column).node;
+            r->cells.remove(first, n);
+            renumber(r, first);
+        }
+        columnCount -= count;
+    }
+
+    // destination counts the moved columns when they move to the right
+    void moveColumns(int first, int count, int destination) {
+        if (destination > first)
+            destination -= count;
+        foreach (Row *r, rowRecords(0, rows.count())) {
+            if (r->cells.isEmpty())
+                continue;
+            r->cells.resize(columnCount);
+            QVector<Cell> moved = r->cells.mid(first, count);
+            r->cells.remove(first, count);
+            for (int i = 0; i < moved.count(); i++)
+                r->cells.insert(destination + i, moved.at(i));
+            renumber(r, 0);
+        }
+    }
+
+    void renumber(Row *r, int from) {
+        for (int column = from; column < r->cells.count(); column++) {
+            if (r->cells.at(column).node)
+                r->cells[column].node->column = column;
         }
     }
 
-    int row;
-    int column;
     Node *parent;
-    mutable QList<Node *> children;
+    Row *rowRecord;
+    int column;
+    // children, row by row, each row with columnCount cells
+    QRemoteModelRowIndex rows;
+    int columnCount;
+    // server side handle, 0 if there is none
+    quint32 handle;
+
+    // rows is only authoritative once fetched is set; until then
+    // hasChildrenHint tells whether there is anything to fetch
+    bool fetched;
+    bool fetching;
+    bool hasChildrenHint;
+    // the server side model itself can fetch more below this node
+    bool canFetchMore;
 };
 
+Row::~Row()
+{
+    if (cache)
+        cache->unlink(this);
+    foreach (const Cell &cell, cells)
+        delete cell.node;
+}
+
+// roughly what a value takes in memory, including its hash entry
+static qint64 costOf(const QVariant &value)
+{
+    qint64 ret = sizeof(QVariant) + 2 * sizeof(void *);
+    switch (value.userType()) {
+    case QMetaType::QString:
+        ret += value.toString().size() * sizeof(QChar);
+        break;
+    case QMetaType::QByteArray:
+        ret += value.toByteArray().size();
+        break;
+    case QMetaType::QVariantList:
+        foreach (const QVariant &v, value.toList())
+            ret += costOf(v);
+        break;
+    case QMetaType::QVariantMap:
+        foreach (const QVariant &v, value.toMap())
+            ret += costOf(v);
+        break;
+    default:
+        break;
+    }
+    return ret;
+}
+
+static qint64 costOf(const Row *row)
+{
+    qint64 ret = sizeof(Row) + row->cells.capacity() * sizeof(Cell);
+    foreach (const Cell &cell, row->cells) {
+        foreach (const QVariant &value, cell.values)
+            ret += costOf(value);
+    }
+    return ret;
+}
+
+void ValueCache::insert(Row *row)
+{
+    if (row->cache)
+        unlink(row);
+    row->cost = costOf(row);
+    row->cache = this;
+    row->previous = last;
+    row->next = Q_NULLPTR;
+    if (last)
+        last->next = row;
+    else
+        first = row;
+    last = row;
+    size += row->cost;
+    rows++;
+}
+
+void ValueCache::touch(Row *row)
+{
+    if (!row->cache || row == last)
+        return;
+    if (row->previous)
+        row->previous->next = row->next;
+    else
+        first = row->next;
+    row->next->previous = row->previous;
+    row->previous = last;
+    row->next = Q_NULLPTR;
+    last->next = row;
+    last = row;
+}
+
+void ValueCache::recount(Row *row)
+{
+    if (!row->cache)
+        return;
+    qint64 cost = costOf(row);
+    size += cost - row->cost;
+    row->cost = cost;
+}
+
+void ValueCache::unlink(Row *row)
+{
+    if (row->previous)
+        row->previous->next = row->next;
+    else
+        first = row->next;
+    if (row->next)
+        row->next->previous = row->previous;
+    else
+        last = row->previous;
+    size -= row->cost;
+    rows--;
+    row->cache = Q_NULLPTR;
+    row->previous = row->next = Q_NULLPTR;
+    row->cost = 0;
+}
+
+void ValueCache::trim(const Row *keep)
+{
+    while (size > budget && budget > 0 && first && first != keep) {
+        Row *row = first;
+        evictions++;
+        if (row->hasNodes()) {
+            // the record stays for the children, only the values go
+            unlink(row);
+            for (int column = 0; column < row->cells.count(); column++) {
+                row->cells[column].values.clear();
+                row->cells[column].flags = -1;
+            }
+        } else {
+            QRemoteModelRowIndex &index = row->parent->rows;
+            foreach (QRemoteModelRowIndex::Item *item, index.evict(index.positionOf(row), 1))
+                delete static_cast<Row *>(item);
+        }
+    }
+}
+
+QVariantMap ValueCache::statistics() const
+{
+    QVariantMap ret;
+    ret.insert(QStringLiteral("hits"), hits);
+    ret.insert(QStringLiteral("misses"), misses);
+    ret.insert(QStringLiteral("evictions"), evictions);
+    ret.insert(QStringLiteral("rows"), rows);
+    ret.insert(QStringLiteral("size"), size);
+    ret.insert(QStringLiteral("budget"), budget);
+    return ret;
+}
+
 QDebug operator<<(QDebug dbg, const Node *node) {
     dbg.nospace() << "Node {";
     if (node) {
-        dbg << " row: " << node->row << "; column: " << node->column << ";";
+        dbg << " row: " << node->row() << "; column: " << node->column << ";";
         if (node->parent)
             dbg << " parent: " << node->parent << ";";
     }
@@ -91,18 +470,54 @@ QDebug operator<<(QDebug dbg, const Node *node) {
     return dbg.space();
 }
 
-class QRemoteModelClient::Private : public QTcpSocket
+class QRemoteModelClient::Private : public QObject
 {
     Q_OBJECT
 public:
+    typedef std::function<void(const QVariant &)> Callback;
+
     Private(QRemoteModelClient *parent);
     ~Private();
 
-    QVariant methodCall(const QByteArray &method, const QVariantList &args = QVariantList());
+    // a QTcpSocket or a QLocalSocket, replacing the one before
+    void setSocket(QIODevice *socket);
+    // mirrors the model of the name over the socket of connection
+    void setConnection(Private *connection, const QString &name);
+    void open();
+    quint32 invoke(const QByteArray &method, const QVariantList &args = QVariantList(), const Callback &callback = Callback());
+    // a call that expects no answer
+    void notify(const QByteArray &method, const QVariantList &args = QVariantList());
+    bool waitForRoleNames(int msecs = 30000);
+
+    Node *node(const QModelIndex &index) const;
+    Row *rowOf(const QModelIndex &index, bool create = false) const;
+    Node *nodeAt(const QVariant &path, bool create = false) const;
+    Node *parentAt(const QVariant &path, int *row, int *column) const;
+    QModelIndex indexOf(Node *node) const;
+    QVariant path(const QModelIndex &index) const;
+
+    void fetchStructure();
+    void fetchSnapshot();
+    void fetchChildren(const QModelIndex &parent);
+    void fetchMore(const QModelIndex &parent);
+    void readShape(QDataStream &stream, Node *parent, bool notify, const QModelIndex &index = QModelIndex());
+    void fetchData(const QModelIndex &index, int role);
+    void fetchRange(const QModelIndex &parent, int first, int last, const QVector<int> &roles);
+    void fetchQueuedData();
+    void scheduleWrite();
+    void fetchFlags(const QModelIndex &index);
+    void fetchHeaderData(int section, Qt::Orientation orientation, int role);
+    void scheduleSubscription();
+    void invalidate(Node *parent, int first, int last);
 
 private slots:
     void init();
-    void construct(const QModelIndex &parent = QModelIndex());
+    void subscribe();
+    void regionRowsInserted(const QModelIndex &parent, int first, int last);
+    void regionRowsRemoved(const QModelIndex &parent, int first, int last);
+    void regionRowsMoved();
+    void connectionLost();
+    void writeRequests();
     void readData();
 
     void dataChanged(const QVariantList &args);
@@ -126,204 +541,942 @@ private slots:
 
     void modelAboutToBeReset(const QVariantList &args);
     void modelReset(const QVariantList &args);
+    void transaction(const QVariantList &args);
 
 private:
+    void handleMessage(const QRemoteModelMessage &message);
+    void sharedReturn(const QRemoteModelMessage &message);
+    void emitSignal(const QByteArray &signal, const QVariantList &args);
+    bool lostTrack(bool valid, const char *signal);
+
+    // cache misses this many rows apart still share one range request
+    enum { RangeGap = 16 };
+
     QRemoteModelClient *q;
-    QHash<QUuid, QEventLoop *> loops;
-    QHash<QUuid, QVariant> returnValues;
+    QIODevice *socket;
+    // requests are identified by a sequence number; any number of them
+    // can be in flight and their answers may complete in any order
+    quint32 nextId;
+    // requests go out in version 1 until the server agreed on another one
+    int protocolVersion;
+    QRemoteModelCompressor compressor;
+    // inflate context for the server frames once streaming was agreed on
+    QRemoteModelZStream *inflateStream;
+    QHash<quint32, Callback> callbacks;
+    QHash<quint32, QByteArray> partialReturns;
+    // frames and cache misses queued during the current event loop iteration
+    QByteArray outgoing;
+    QList<QPair<QPersistentModelIndex, int> > queuedData;
+    bool writeScheduled;
+    // a reply is only trusted when no structural signal arrived between
+    // sending the request and reading its answer
+    int structureChanges;
+    // the snapshots asked for and not arrived yet; the changes before
+    // them are in them already
+    int snapshotsPending;
+    // the server instance the mirrored model came from, 0 until a
+    // snapshot arrived, and the number of the last change applied to it
+    quint32 serverEpoch;
+    quint32 epoch;
+    quint32 sequence;
 
 public:
     Node *rootNode;
+    ValueCache cache;
+    bool lazy;
+    bool streamingCompression;
+    int maximumUpdateRate;
+    QHash<int, QByteArray> roleNames;
+    bool roleNamesReceived;
+    QHash<QPair<int, int>, QVariant> headerData[2];
+    QSet<QPair<int, int> > pendingHeaderData[2];
+
+    // the client whose socket carries the requests, this unless the model
+    // was opened by name, and the channel of the model on that socket
+    Private *connection;
+    quint32 channel;
+    QString modelName;
+    // the clients sharing the socket of this one, and those with a channel
+    QList<Private *> models;
+    QHash<quint32, Private *> channels;
+
+    // rows first to last below parent and everything below them; last is
+    // -1 for all rows
+    struct Region {
+        bool below(const QModelIndex &index) const {
+            return root ? !index.isValid() : parent == index;
+        }
+
+        QPersistentModelIndex parent;
+        bool root;
+        int first;
+        int last;
+    };
+    // the regions the views watch, and those the server knows of; the
+    // server sends no value changes outside of these
+    QList<Region> regions;
+    QList<Region> subscribed;
+    QVector<int> subscribedRoles;
+    bool subscriptionScheduled;
+    // rows may have moved into a region since the last subscription
+    bool regionsMoved;
+    // the last signal applied, which a subscription refers to
+    quint32 lastSignal;
 };
 
+static bool isStructureChange(const QByteArray &signal)
+{
+    return signal != QByteArrayLiteral("dataChanged") && signal != QByteArrayLiteral("headerDataChanged");
+}
+
 QRemoteModelClient::Private::Private(QRemoteModelClient *parent)
-    : QTcpSocket(parent)
+    : QObject(parent)
     , q(parent)
+    , socket(Q_NULLPTR)
+    , nextId(0)
+    , protocolVersion(QRemoteModelProtocol::Version1)
+    , inflateStream(Q_NULLPTR)
+    , writeScheduled(false)
+    , structureChanges(0)
+    , snapshotsPending(0)
+    , serverEpoch(0)
+    , epoch(0)
+    , sequence(0)
     , rootNode(new Node)
+    , lazy(false)
+    , streamingCompression(false)
+    , maximumUpdateRate(0)
+    , roleNamesReceived(false)
+    , connection(this)
+    , channel(0)
+    , subscriptionScheduled(false)
+    , regionsMoved(false)
+    , lastSignal(0)
 {
-    connect(this, SIGNAL(connected()), this, SLOT(init()));
-    connect(this, SIGNAL(readyRead()), this, SLOT(readData()));
+    connect(q, SIGNAL(rowsInserted(QModelIndex,int,int)), this, SLOT(regionRowsInserted(QModelIndex,int,int)));
+    connect(q, SIGNAL(rowsRemoved(QModelIndex,int,int)), this, SLOT(regionRowsRemoved(QModelIndex,int,int)));
+    connect(q, SIGNAL(rowsMoved(QModelIndex,int,int,QModelIndex,int)), this, SLOT(regionRowsMoved()));
+    connect(q, SIGNAL(modelReset()), this, SLOT(regionRowsMoved()));
 }
 
 QRemoteModelClient::Private::~Private()
 {
+    setConnection(this, QString());
+    foreach (Private *model, models) {
+        model->connection = model;
+        model->channel = 0;
+    }
+    delete inflateStream;
     delete rootNode;
 }
 
 void QRemoteModelClient::Private::init()
 {
-    construct();
+    // a client that still holds a model from this server only catches up
+    quint32 resumeEpoch = epoch;
+    quint32 resumeSequence = sequence;
+    epoch = 0;
+    lastSignal = 0;
+    // the answer to hello switches the requests to the agreed version
+    protocolVersion = QRemoteModelProtocol::Version1;
+    delete inflateStream;
+    inflateStream = Q_NULLPTR;
+    invoke("hello", QVariantList() << int(QRemoteModelProtocol::CurrentVersion) << streamingCompression << maximumUpdateRate << (resumeEpoch != 0), [this](const QVariant &value) {
+        QVariantList args = value.toList();
+        int i = 0;
+        int version = args.value(i++).toInt();
+        if (version >= QRemoteModelProtocol::Version1 && version <= QRemoteModelProtocol::CurrentVersion)
+            protocolVersion = version;
+        // every server frame after this answer goes through the stream
+        if (args.value(i++).toBool())
+            inflateStream = new QRemoteModelZStream(QRemoteModelZStream::Inflate);
+        serverEpoch = args.value(i++).toUInt();
+        sequence = args.value(i++).toUInt();
+        if (!regions.isEmpty())
+            scheduleSubscription();
+    });
+    foreach (Private *model, models)
+        model->open();
+    if (!resumeEpoch) {
+        fetchSnapshot();
+        return;
+    }
+    invoke("resume", QVariantList() << resumeEpoch << resumeSequence, [this, resumeEpoch](const QVariant &value) {
+        QVariantList args = value.toList();
+        int i = 0;
+        bool resumed = args.value(i++).toBool();
+        // the missed changes arrived ahead of this answer
+        if (resumed) {
+            epoch = resumeEpoch;
+            return;
+        }
+        if (args.count() > i)
+            sequence = args.value(i++).toUInt();
+        fetchSnapshot();
+    });
 }
 
-void QRemoteModelClient::Private::construct(const QModelIndex &parent)
+// the models opened by name always start from a snapshot
+void QRemoteModelClient::Private::open()
 {
-    Node *parentNode = parent.internalPointer() ? static_cast<Node *>(parent.internalPointer()) : rootNode;
-    qDebug() << parentNode->row << parentNode->column << parentNode->parent;
-    bool hasChildren = methodCall("hasChildren", QVariantList() << QtRemoteModel::fromModelIndex(parent)).toBool();
-    if (hasChildren) {
-        int rowCount = methodCall("rowCount", QVariantList() << QtRemoteModel::fromModelIndex(parent)).toInt();
-        int columnCount = methodCall("columnCount", QVariantList() << QtRemoteModel::fromModelIndex(parent)).toInt();
-        columnsAboutToBeInserted(QVariantList() << parent << 0 << columnCount - 1);
-        columnsInserted(QVariantList());
-        rowsAboutToBeInserted(QVariantList() << parent << 0 << rowCount - 1);
-        rowsInserted(QVariantList() << parent << 0 << rowCount - 1);
-        for (int row = 0; row < rowCount; row++) {
-            for (int column = 0; column < columnCount; column++) {
-                construct(q->index(row, column, parent));
-            }
+    lastSignal = 0;
+    invoke("open", QVariantList() << modelName, [this](const QVariant &value) {
+        channel = value.toUInt();
+        if (!channel) {
+            qCWarning(lcRemoteModel) << "no model named" << modelName;
+            return;
+        }
+        connection->channels.insert(channel, this);
+        fetchSnapshot();
+        if (!regions.isEmpty())
+            scheduleSubscription();
+    });
+}
+
+void QRemoteModelClient::Private::setConnection(Private *connection, const QString &name)
+{
+    if (this->connection != this) {
+        this->connection->models.removeAll(this);
+        this->connection->channels.remove(channel);
+    }
+    channel = 0;
+    modelName = name;
+    this->connection = connection;
+    if (connection == this)
+        return;
+    setSocket(Q_NULLPTR);
+    connection->models.append(this);
+    // otherwise opened once connected
+    if (connection->socket && connection->socket->isOpen())
+        open();
+}
+
+void QRemoteModelClient::Private::fetchSnapshot()
+{
+    invoke("roleNames", QVariantList(), [this](const QVariant &value) {
+        roleNames.clear();
+        QHashIterator<QString, QVariant> i(value.toHash());
+        while (i.hasNext()) {
+            i.next();
+            roleNames.insert(i.key().toInt(), i.value().toByteArray());
+        }
+        roleNamesReceived = true;
+    });
+    fetchStructure();
+}
+
+// answers to the requests in flight are lost with the connection; their
+// pending state only clears with a new snapshot
+void QRemoteModelClient::Private::connectionLost()
+{
+    if (!callbacks.isEmpty())
+        epoch = 0;
+    callbacks.clear();
+    partialReturns.clear();
+    outgoing.clear();
+    foreach (Private *model, channels)
+        model->channel = 0;
+    channels.clear();
+    // the server forgot the subscriptions along with the connection
+    subscribed.clear();
+    foreach (Private *model, models)
+        model->subscribed.clear();
+    // the snapshots asked for never come
+    snapshotsPending = 0;
+    foreach (Private *model, models)
+        model->snapshotsPending = 0;
+}
+
+void QRemoteModelClient::Private::setSocket(QIODevice *socket)
+{
+    if (this->socket) {
+        this->socket->disconnect(this);
+        if (this->socket->isOpen()) {
+            this->socket->close();
+            connectionLost();
+        }
+        this->socket->deleteLater();
+    }
+    this->socket = socket;
+    if (!socket)
+        return;
+    connect(socket, SIGNAL(connected()), this, SLOT(init()));
+    connect(socket, SIGNAL(disconnected()), this, SLOT(connectionLost()));
+    connect(socket, SIGNAL(readyRead()), this, SLOT(readData()));
+}
+
+bool QRemoteModelClient::Private::waitForRoleNames(int msecs)
+{
+    writeRequests();
+    connection->writeRequests();
+    connection->readData();
+    while (!roleNamesReceived) {
+        if (!connection->socket || !connection->socket->waitForReadyRead(msecs))
+            return false;
+        connection->readData();
+        // the snapshot of a model opened by name is asked for meanwhile
+        connection->writeRequests();
+    }
+    return true;
+}
+
+// the internal pointer of an index is the node whose rows hold the cell
+Node *QRemoteModelClient::Private::node(const QModelIndex &index) const
+{
+    if (!index.isValid())
+        return rootNode;
+    return static_cast<Node *>(index.internalPointer())->child(index.row(), index.column());
+}
+
+Row *QRemoteModelClient::Private::rowOf(const QModelIndex &index, bool create) const
+{
+    return static_cast<Node *>(index.internalPointer())->rowAt(index.row(), create);
+}
+
+// resolves a path sent by the server, or returns null when it leads
+// below a node whose children were never fetched or to a cell without
+// children; create makes a node for such a cell
+Node *QRemoteModelClient::Private::nodeAt(const QVariant &path, bool create) const
+{
+    int row, column;
+    Node *parent = parentAt(path, &row, &column);
+    if (!parent)
+        return path.toList().isEmpty() ? rootNode : Q_NULLPTR;
+    return parent->child(row, column, create);
+}
+
+// the node holding the cell a path leads to, null when it is not mirrored
+Node *QRemoteModelClient::Private::parentAt(const QVariant &path, int *row, int *column) const
+{
+    QVariantList points = path.toList();
+    if (points.isEmpty())
+        return Q_NULLPTR;
+    Node *ret = rootNode;
+    for (int i = 0; ret && i < points.count(); i++) {
+        if (!ret->fetched)
+            return Q_NULLPTR;
+        QPoint point = points.at(i).toPoint();
+        if (i == points.count() - 1) {
+            if (point.y() >= ret->rows.count() || point.x() >= ret->columnCount)
+                return Q_NULLPTR;
+            *row = point.y();
+            *column = point.x();
+            return ret;
         }
+        ret = ret->child(point.y(), point.x());
     }
+    return Q_NULLPTR;
 }
 
-QVariant QRemoteModelClient::Private::methodCall(const QByteArray &method, const QVariantList &args)
-{
-    while (!loops.isEmpty()) {
-        QCoreApplication::processEvents();
-        qDebug() << method << args << bytesAvailable() << loops;
-        readData();
-    }
-    QUuid uuid = QUuid::createUuid();
-    QByteArray request;
-    {
-        QDataStream in(&request, QIODevice::WriteOnly);
-        in << uuid;
-        in << QtRemoteModel::MethodCall;
-        in << method;
-        in << args;
-    }
-    request = qCompress(request);
-    int length = request.length();
-    QByteArray header(QtRemoteModel::HeaderLength, Qt::Uninitialized);
-    for (int i = 0; i < QtRemoteModel::HeaderLength; i++) {
-        header[0] = (length & 0xff000000) >> 24;
-        header[1] = (length & 0x00ff0000) >> 16;
-        header[2] = (length & 0x0000ff00) >>  8;
-        header[3] = (length & 0x000000ff);
-    }
-    qDebug() << length << method << method << args << uuid << loops.keys() << loops.values();
-    if (write(header) != header.length())
-        Q_UNREACHABLE();
-    if (write(request) != request.length())
-        Q_UNREACHABLE();
-    QEventLoop loop;
-    loops.insert(uuid, &loop);
-//    qDebug() << &loop;
-    loop.exec();
-//    loops.remove(uuid);
-    QVariant ret = returnValues.take(uuid);
-    qDebug() << ret;
+QModelIndex QRemoteModelClient::Private::indexOf(Node *node) const
+{
+    if (!node || node == rootNode)
+        return QModelIndex();
+    return q->createIndex(node->row(), node->column, node->parent);
+}
+
+// requests name a node relative to its closest ancestor with a handle,
+// which the server resolves without walking down from the root
+QVariant QRemoteModelClient::Private::path(const QModelIndex &index) const
+{
+    QVariantList ret;
+    if (!index.isValid())
+        return ret;
+    Node *n = node(index);
+    if (n && n->handle)
+        return QVariantList() << n->handle;
+    ret.prepend(QPoint(index.column(), index.row()));
+    for (n = static_cast<Node *>(index.internalPointer()); n != rootNode; n = n->parent) {
+        if (n->handle) {
+            ret.prepend(n->handle);
+            break;
+        }
+        ret.prepend(QPoint(n->column, n->row()));
+    }
     return ret;
 }
 
-void QRemoteModelClient::Private::readData()
+void QRemoteModelClient::Private::fetchStructure()
+{
+    snapshotsPending++;
+    invoke("structure", QVariantList() << QVariant(QVariantList()) << (lazy ? 1 : -1), [this](const QVariant &value) {
+        if (snapshotsPending > 0)
+            snapshotsPending--;
+        // a later snapshot is on its way
+        if (snapshotsPending > 0)
+            return;
+        QDataStream stream(value.toByteArray());
+        epoch = serverEpoch;
+        q->beginResetModel();
+        delete rootNode;
+        rootNode = new Node;
+        headerData[0].clear();
+        headerData[1].clear();
+        readShape(stream, rootNode, false);
+        q->endResetModel();
+    });
+}
+
+void QRemoteModelClient::Private::fetchChildren(const QModelIndex &parent)
+{
+    Node *parentNode = node(parent);
+    if (!parentNode || parentNode->fetched || parentNode->fetching)
+        return;
+    parentNode->fetching = true;
+    QPersistentModelIndex persistentParent(parent);
+    int serial = structureChanges;
+    invoke("structure", QVariantList() << path(parent) << (lazy ? 1 : -1), [this, persistentParent, serial](const QVariant &value) {
+        if (!persistentParent.isValid())
+            return;
+        Node *parentNode = node(persistentParent);
+        if (!parentNode)
+            return;
+        parentNode->fetching = false;
+        if (parentNode->fetched)
+            return;
+        if (serial != structureChanges) {
+            fetchChildren(persistentParent);
+            return;
+        }
+        QDataStream stream(value.toByteArray());
+        readShape(stream, parentNode, true, persistentParent);
+    });
+}
+
+void QRemoteModelClient::Private::fetchMore(const QModelIndex &parent)
+{
+    Node *parentNode = node(parent);
+    if (!parentNode) {
+        return;
+    } else if (!parentNode->fetched) {
+        fetchChildren(parent);
+    } else if (parentNode->canFetchMore) {
+        // the server model inserts the rows itself and tells whether there is still more
+        parentNode->canFetchMore = false;
+        QPersistentModelIndex persistentParent(parent);
+        bool isRoot = !parent.isValid();
+        invoke("fetchMore", QVariantList() << path(parent), [this, persistentParent, isRoot](const QVariant &value) {
+            if (!isRoot && !persistentParent.isValid())
+                return;
+            if (Node *parentNode = node(persistentParent))
+                parentNode->canFetchMore = value.toBool();
+        });
+    }
+}
+
+// rowCount, columnCount, canFetchMore and the cells with children,
+// each of them either expanded with its own shape or only hinted
+void QRemoteModelClient::Private::readShape(QDataStream &stream, Node *parent, bool notify, const QModelIndex &index)
+{
+    qint32 rowCount, columnCount, branchCount;
+    bool canFetchMore;
+    stream >> rowCount >> columnCount >> canFetchMore;
+    if (notify && rowCount > 0)
+        q->beginInsertRows(index, 0, rowCount - 1);
+    parent->fetched = true;
+    parent->canFetchMore = canFetchMore;
+    parent->columnCount = columnCount;
+    parent->insertRows(0, rowCount);
+    stream >> branchCount;
+    for (int i = 0; i < branchCount; i++) {
+        qint32 row, column;
+        quint32 handle;
+        bool expanded;
+        stream >> row >> column >> handle >> expanded;
+        Node *child = parent->child(row, column, true);
+        child->handle = handle;
+        child->hasChildrenHint = true;
+        if (expanded)
+            readShape(stream, child, false);
+    }
+    if (notify && rowCount > 0)
+        q->endInsertRows();
+}
+
+// a model opened by name sends through its connection, which may
+// outlive it
+quint32 QRemoteModelClient::Private::invoke(const QByteArray &method, const QVariantList &args, const Callback &callback)
+{
+    Private *c = connection;
+    // 0 is reserved for signals
+    if (++c->nextId == 0)
+        ++c->nextId;
+    quint32 id = c->nextId;
+    QRemoteModelMessage message;
+    message.type = QtRemoteModel::MethodCall;
+    message.id = id;
+    message.name = method;
+    message.opcode = QRemoteModelProtocol::opcode(method);
+    message.args = args;
+    message.channel = channel;
+    c->scheduleWrite();
+    c->outgoing.append(QRemoteModelProtocol::frame(message, c->protocolVersion, &c->compressor));
+    if (c != this && callback) {
+        QPointer<Private> self(this);
+        c->callbacks.insert(id, [self, callback](const QVariant &value) {
+            if (self)
+                callback(value);
+        });
+    } else {
+        c->callbacks.insert(id, callback);
+    }
+    return id;
+}
+
+void QRemoteModelClient::Private::notify(const QByteArray &method, const QVariantList &args)
+{
+    Private *c = connection;
+    QRemoteModelMessage message;
+    message.type = QtRemoteModel::MethodCall;
+    message.name = method;
+    message.opcode = QRemoteModelProtocol::opcode(method);
+    message.args = args;
+    message.channel = channel;
+    c->scheduleWrite();
+    c->outgoing.append(QRemoteModelProtocol::frame(message, c->protocolVersion, &c->compressor));
+}
+
+void QRemoteModelClient::Private::scheduleWrite()
+{
+    if (writeScheduled)
+        return;
+    writeScheduled = true;
+    QMetaObject::invokeMethod(this, "writeRequests", Qt::QueuedConnection);
+}
+
+void QRemoteModelClient::Private::writeRequests()
+{
+    writeScheduled = false;
+    fetchQueuedData();
+    if (outgoing.isEmpty() || !socket)
+        return;
+    if (socket->write(outgoing) != outgoing.length())
+        qCWarning(lcRemoteModel) << socket->errorString();
+    outgoing.clear();
+}
+
+void QRemoteModelClient::Private::fetchData(const QModelIndex &index, int role)
+{
+    Cell *cell = rowOf(index, true)->cell(index.column());
+    if (cell->pendingRoles.contains(role))
+        return;
+    cell->pendingRoles.insert(role);
+    queuedData.append(qMakePair(QPersistentModelIndex(index), role));
+    scheduleWrite();
+}
+
+// the misses of one event loop iteration become range requests, one
+// for each run of nearby rows below the same parent
+void QRemoteModelClient::Private::fetchQueuedData()
 {
-//    qDebug() << bytesAvailable();
-    while (bytesAvailable() >= QtRemoteModel::HeaderLength) {
-        QByteArray header = peek(QtRemoteModel::HeaderLength);
-        qint64 length = 0;
-        length |= header.at(0) << 24;
-        length |= header.at(1) << 16;
-        length |= header.at(2) <<  8;
-        length |= header.at(3);
-        if (bytesAvailable() >= QtRemoteModel::HeaderLength + length) {
-            if (read(QtRemoteModel::HeaderLength).length() != QtRemoteModel::HeaderLength)
-                Q_UNREACHABLE();
-            QByteArray data = read(length);
-            if (data.length() != length) {
-                Q_UNREACHABLE();
+    struct Misses {
+        QPersistentModelIndex parent;
+        QList<int> rows;
+        QSet<int> roles;
+    };
+    QHash<Node *, Misses> missesByParent;
+    typedef QPair<QPersistentModelIndex, int> Miss;
+    foreach (const Miss &miss, queuedData) {
+        if (!miss.first.isValid())
+            continue;
+        Misses &misses = missesByParent[static_cast<Node *>(miss.first.internalPointer())];
+        if (misses.rows.isEmpty())
+            misses.parent = miss.first.parent();
+        misses.rows.append(miss.first.row());
+        misses.roles.insert(miss.second);
+    }
+    queuedData.clear();
+
+    foreach (Misses misses, missesByParent) {
+        std::sort(misses.rows.begin(), misses.rows.end());
+        QVector<int> roles = misses.roles.toList().toVector();
+        int first = misses.rows.first();
+        int last = first;
+        foreach (int row, misses.rows) {
+            if (row > last + RangeGap) {
+                fetchRange(misses.parent, first, last, roles);
+                first = row;
             }
-            data = qUncompress(data);
-            QDataStream stream(data);
-            QUuid uuid;
-            int type;
-            stream >> uuid;
-            stream >> type;
-//            qDebug() << length << uuid << type;
-
-            switch (type) {
-            case QtRemoteModel::MethodReturn:
-                if (loops.contains(uuid)) {
-                    QVariant returnValue;
-                    stream >> returnValue;
-//                    qDebug() << returnValue;
-                    returnValues.insert(uuid, returnValue);
-                    loops.take(uuid)->quit();
-                } else {
-                    qDebug() << loops << uuid;
-                    Q_UNREACHABLE();
-                }
-                break;
-            case QtRemoteModel::EmitSignal: {
-                QByteArray signal;
-                QVariantList args;
-                stream >> signal;
-                stream >> args;
-                qDebug() << signal << args;
-                QMetaObject::invokeMethod(this, signal.constData(), Qt::QueuedConnection, Q_ARG(QVariantList, args));
-#if 0
-                if (signal == QByteArrayLiteral("dataChanged")) {
-                    dataChanged(args);
-                } else if (signal == QByteArrayLiteral("headerDataChanged")) {
-                    headerDataChanged(args);
-                } else if (signal == QByteArrayLiteral("layoutChanged")) {
-                    layoutChanged(args);
-                } else if (signal == QByteArrayLiteral("layoutAboutToBeChanged")) {
-                    layoutAboutToBeChanged(args);
-                } else if (signal == QByteArrayLiteral("rowsAboutToBeInserted")) {
-                    rowsAboutToBeInserted(args);
-                } else if (signal == QByteArrayLiteral("rowsInserted")) {
-                    rowsInserted(args);
-                } else if (signal == QByteArrayLiteral("rowsAboutToBeMoved")) {
-                    rowsAboutToBeMoved(args);
-                } else if (signal == QByteArrayLiteral("rowsMoved")) {
-                    rowsMoved(args);
-                } else if (signal == QByteArrayLiteral("rowsAboutToBeRemoved")) {
-                    rowsAboutToBeRemoved(args);
-                } else if (signal == QByteArrayLiteral("rowsRemoved")) {
-                    rowsRemoved(args);
-                } else if (signal == QByteArrayLiteral("columnsAboutToBeInserted")) {
-                    columnsAboutToBeInserted(args);
-                } else if (signal == QByteArrayLiteral("columnsInserted")) {
-                    columnsInserted(args);
-                } else if (signal == QByteArrayLiteral("columnsAboutToBeMoved")) {
-                    columnsAboutToBeMoved(args);
-                } else if (signal == QByteArrayLiteral("columnsMoved")) {
-                    columnsMoved(args);
-                } else if (signal == QByteArrayLiteral("columnsAboutToBeRemoved")) {
-                    columnsAboutToBeRemoved(args);
-                } else if (signal == QByteArrayLiteral("columnsRemoved")) {
-                    columnsRemoved(args);
-                } else if (signal == QByteArrayLiteral("modelAboutToBeReset")) {
-                    modelAboutToBeReset(args);
-                } else if (signal == QByteArrayLiteral("modelReset")) {
-                    modelReset(args);
-                } else {
-                    qWarning() << signal << args;
-                    Q_UNREACHABLE();
+            last = row;
+        }
+        fetchRange(misses.parent, first, last, roles);
+    }
+}
+
+void QRemoteModelClient::Private::fetchRange(const QModelIndex &parent, int first, int last, const QVector<int> &roles)
+{
+    QPersistentModelIndex persistentParent(parent);
+    bool isRoot = !parent.isValid();
+    int serial = structureChanges;
+    QVariantList args;
+    args << path(parent) << first << last << QtRemoteModel::toVariant(roles);
+    invoke("rangeData", args, [this, persistentParent, isRoot, first, last, roles, serial](const QVariant &value) {
+        if (!isRoot && !persistentParent.isValid())
+            return;
+        Node *parentNode = node(persistentParent);
+        if (!parentNode)
+            return;
+        // one list of row values for each column and role, column by column
+        QVariantList block = value.toList();
+        bool valid = serial == structureChanges;
+        // a stale answer only clears the pending roles of the rows still there
+        int count = last - first + 1;
+        QVector<Row *> rows = valid ? parentNode->rowRange(first, count) : parentNode->rowRecords(first, count);
+        int offset = 0;
+        foreach (Row *row, rows) {
+            for (int column = 0; column < parentNode->columnCount; column++) {
+                Cell *cell = row->cell(column);
+                for (int i = 0; i < roles.count(); i++) {
+                    int role = roles.at(i);
+                    cell->pendingRoles.remove(role);
+                    if (!valid)
+                        continue;
+                    QVariantList values = block.value(column * roles.count() + i).toList();
+                    if (offset < values.count())
+                        cell->values.insert(role, values.at(offset));
                 }
-#endif
-                break; }
-            default:
-                qWarning() << type;
-                Q_UNREACHABLE();
-                break;
             }
+            if (valid)
+                cache.insert(row);
+            offset++;
         }
+        if (valid && !rows.isEmpty())
+            cache.trim(rows.first());
+        // on a stale answer the views simply ask again
+        int lastRow = qMin(last, q->rowCount(persistentParent) - 1);
+        int lastColumn = q->columnCount(persistentParent) - 1;
+        if (lastRow >= first && lastColumn >= 0)
+            emit q->dataChanged(q->index(first, 0, persistentParent), q->index(lastRow, lastColumn, persistentParent), roles);
+        if (valid)
+            emit q->rangeFetched(persistentParent, first, last);
+    });
+}
+
+void QRemoteModelClient::Private::fetchFlags(const QModelIndex &index)
+{
+    Cell *cell = rowOf(index, true)->cell(index.column());
+    if (cell->flagsPending)
+        return;
+    cell->flagsPending = true;
+    QPersistentModelIndex persistentIndex(index);
+    int serial = structureChanges;
+    invoke("flags", QVariantList() << path(index), [this, persistentIndex, serial](const QVariant &value) {
+        if (!persistentIndex.isValid())
+            return;
+        Cell *cell = rowOf(persistentIndex, true)->cell(persistentIndex.column());
+        cell->flagsPending = false;
+        if (serial != structureChanges) {
+            fetchFlags(persistentIndex);
+            return;
+        }
+        cell->flags = value.toInt();
+        cache.insert(rowOf(persistentIndex));
+        cache.trim(rowOf(persistentIndex));
+        emit q->dataChanged(persistentIndex, persistentIndex);
+    });
+}
+
+void QRemoteModelClient::Private::fetchHeaderData(int section, Qt::Orientation orientation, int role)
+{
+    QPair<int, int> key(section, role);
+    QSet<QPair<int, int> > &pending = pendingHeaderData[orientation - 1];
+    if (pending.contains(key))
+        return;
+    pending.insert(key);
+    invoke("headerData", QVariantList() << section << orientation << role, [this, key, orientation](const QVariant &value) {
+        if (!pendingHeaderData[orientation - 1].remove(key))
+            return;
+        headerData[orientation - 1].insert(key, value);
+        emit q->headerDataChanged(orientation, key.first, key.first);
+    });
+}
+
+void QRemoteModelClient::Private::readData()
+{
+    while (socket) {
+        QRemoteModelMessage message;
+        QRemoteModelProtocol::FrameStatus status = QRemoteModelProtocol::readFrame(socket, &message, &compressor, inflateStream);
+        if (status == QRemoteModelProtocol::BrokenFrame) {
+            // the next frames cannot be told apart, start over
+            socket->close();
+            break;
+        }
+        if (status == QRemoteModelProtocol::NoFrame)
+            break;
+        handleMessage(message);
     }
 }
 
+void QRemoteModelClient::Private::handleMessage(const QRemoteModelMessage &message)
+{
+    quint32 id = message.id;
+    switch (message.type) {
+    case QtRemoteModel::MethodReturn:
+        if (callbacks.contains(id)) {
+            QVariant returnValue = message.value;
+            if (partialReturns.contains(id))
+                returnValue = partialReturns.take(id).append(returnValue.toByteArray());
+            Callback callback = callbacks.take(id);
+            if (callback)
+                callback(returnValue);
+        } else {
+            qCWarning(lcRemoteModel) << "unexpected reply" << id;
+        }
+        break;
+    case QtRemoteModel::PartialReturn:
+        partialReturns[id].append(message.value.toByteArray());
+        break;
+    case QtRemoteModel::ErrorReturn: {
+        // the callback still runs so that pending state gets cleared
+        qCWarning(lcRemoteModel) << message.value.toString();
+        partialReturns.remove(id);
+        Callback callback = callbacks.take(id);
+        if (callback)
+            callback(QVariant());
+        break; }
+    case QtRemoteModel::EmitSignal: {
+        // only the changes of the default model are numbered for resuming
+        Private *target = message.channel ? channels.value(message.channel) : this;
+        if (!target) {
+            qCWarning(lcRemoteModel) << "unexpected channel" << message.channel;
+            break;
+        }
+        if (id && !message.channel)
+            sequence = id;
+        if (id)
+            target->lastSignal = id;
+        target->emitSignal(message.name, message.args);
+        break; }
+    case QtRemoteModel::SharedReturn:
+        sharedReturn(message);
+        break;
+    default:
+        qCWarning(lcRemoteModel) << "unexpected frame" << message.type << id;
+        break;
+    }
+}
+
+// the answer is copied out of the segment, which the server frees then
+void QRemoteModelClient::Private::sharedReturn(const QRemoteModelMessage &message)
+{
+    QVariantList args = message.value.toList();
+    int i = 0;
+    QString key = args.value(i++).toString();
+    int length = args.value(i++).toInt();
+    QByteArray payload;
+    QSharedMemory segment(key);
+    if (segment.attach(QSharedMemory::ReadOnly) && segment.size() >= length)
+        payload = QByteArray(static_cast<const char *>(segment.constData()), length);
+    else
+        qCWarning(lcRemoteModel) << segment.errorString();
+    segment.detach();
+    notify("release", QVariantList() << key);
+
+    QRemoteModelMessage answer;
+    if (!payload.isEmpty() && QRemoteModelProtocol::decode(payload, QRemoteModelProtocol::BinaryFrame, &answer)
+            && answer.type != QtRemoteModel::SharedReturn && answer.id == message.id) {
+        handleMessage(answer);
+        return;
+    }
+    // the callback still runs so that pending state gets cleared
+    Callback callback = callbacks.take(message.id);
+    if (callback)
+        callback(QVariant());
+}
+
+void QRemoteModelClient::Private::emitSignal(const QByteArray &signal, const QVariantList &args)
+{
+    if (isStructureChange(signal))
+        structureChanges++;
+    if (snapshotsPending > 0)
+        return;
+    QMetaObject::invokeMethod(this, signal.constData(), Qt::DirectConnection, Q_ARG(QVariantList, args));
+    // the server holds the regions to the row numbers before the change
+    // until it hears of them again
+    if (isStructureChange(signal) && !subscribed.isEmpty())
+        scheduleSubscription();
+}
+
+// a change that does not fit the mirrored rows means a signal got lost;
+// the rest up to a new snapshot is dropped
+bool QRemoteModelClient::Private::lostTrack(bool valid, const char *signal)
+{
+    if (valid)
+        return false;
+    qCWarning(lcRemoteModel) << signal << "out of range, fetching the model again";
+    fetchStructure();
+    return true;
+}
+
+void QRemoteModelClient::Private::scheduleSubscription()
+{
+    if (subscriptionScheduled)
+        return;
+    subscriptionScheduled = true;
+    QMetaObject::invokeMethod(this, "subscribe", Qt::QueuedConnection);
+}
+
+// the server sent no changes for rows outside of the regions, so the
+// values of rows new to them are dropped and fetched again
+void QRemoteModelClient::Private::subscribe()
+{
+    subscriptionScheduled = false;
+    if (!connection->socket || !connection->socket->isOpen()
+            || connection->protocolVersion < QRemoteModelProtocol::Version3 || (connection != this && !channel))
+        return;
+    // regions below removed rows go with them
+    for (int i = regions.count() - 1; i >= 0; i--) {
+        if (!regions.at(i).root && !regions.at(i).parent.isValid())
+            regions.removeAt(i);
+    }
+    if (!subscribed.isEmpty() && regions.isEmpty()) {
+        invalidate(rootNode, 0, -1);
+    } else if (!subscribed.isEmpty()) {
+        foreach (const Region &region, regions) {
+            Node *parentNode = node(region.parent);
+            if (!parentNode)
+                continue;
+            const Region *old = Q_NULLPTR;
+            for (int i = 0; !regionsMoved && !old && i < subscribed.count(); i++) {
+                if (subscribed.at(i).below(region.parent))
+                    old = &subscribed.at(i);
+            }
+            if (!old) {
+                invalidate(parentNode, region.first, region.last);
+                continue;
+            }
+            int last = region.last < 0 ? INT_MAX : region.last;
+            invalidate(parentNode, region.first, qMin(last, old->first - 1));
+            if (old->last >= 0)
+                invalidate(parentNode, qMax(region.first, old->last + 1), region.last);
+        }
+    }
+    regionsMoved = false;
+    subscribed = regions;
+
+    QVariantList args;
+    foreach (const Region &region, regions)
+        args.append(QVariant(QVariantList() << QtRemoteModel::fromModelIndex(region.parent) << region.first << region.last));
+    notify("subscribe", QVariantList() << QVariant(args) << QtRemoteModel::toVariant(subscribedRoles) << lastSignal);
+}
+
+// last -1 for all rows
+void QRemoteModelClient::Private::invalidate(Node *parent, int first, int last)
+{
+    if (last < 0 || last >= parent->rows.count())
+        last = parent->rows.count() - 1;
+    if (first > last)
+        return;
+    foreach (Row *r, parent->rowRecords(first, last - first + 1)) {
+        for (int column = 0; column < r->cells.count(); column++) {
+            Cell *cell = r->cell(column);
+            cell->values.clear();
+            cell->flags = -1;
+            if (cell->node)
+                invalidate(cell->node, 0, -1);
+        }
+        cache.recount(r);
+    }
+    if (parent->columnCount > 0)
+        emit q->dataChanged(q->createIndex(first, 0, parent), q->createIndex(last, parent->columnCount - 1, parent));
+}
+
+// the regions follow their rows, so that rows which were watched all
+// along keep their values
+void QRemoteModelClient::Private::regionRowsInserted(const QModelIndex &parent, int first, int last)
+{
+    int count = last - first + 1;
+    QList<Region> *lists[] = { &regions, &subscribed };
+    for (int l = 0; l < 2; l++) {
+        for (int i = 0; i < lists[l]->count(); i++) {
+            Region &region = (*lists[l])[i];
+            if (!region.below(parent))
+                continue;
+            if (first <= region.first) {
+                region.first += count;
+                if (region.last >= 0)
+                    region.last += count;
+            } else if (region.last >= 0 && first <= region.last) {
+                region.last += count;
+            }
+        }
+    }
+}
+
+void QRemoteModelClient::Private::regionRowsRemoved(const QModelIndex &parent, int first, int last)
+{
+    int count = last - first + 1;
+    QList<Region> *lists[] = { &regions, &subscribed };
+    for (int l = 0; l < 2; l++) {
+        for (int i = 0; i < lists[l]->count(); i++) {
+            Region &region = (*lists[l])[i];
+            if (!region.below(parent))
+                continue;
+            if (region.last >= 0)
+                region.last = region.last > last ? region.last - count : qMin(region.last, first - 1);
+            region.first = region.first > last ? region.first - count : qMin(region.first, first);
+        }
+    }
+}
+
+void QRemoteModelClient::Private::regionRowsMoved()
+{
+    regionsMoved = true;
+}
+
 void QRemoteModelClient::Private::dataChanged(const QVariantList &args)
 {
     int i = 0;
-    QModelIndex topLeft = QtRemoteModel::toModelIndex(q, args.at(i++));
-    QModelIndex bottomRight = QtRemoteModel::toModelIndex(q, args.at(i++));
+    int top, left, bottom, right;
+    Node *parentNode = parentAt(args.at(i++), &top, &left);
+    if (!parentNode || parentAt(args.at(i++), &bottom, &right) != parentNode)
+        return;
     QVector<int> roles;
     foreach (const QVariant &v, args.at(i++).toList()) {
         roles.append(v.toInt());
     }
-    qDebug() << topLeft << bottomRight << roles;
-    emit q->dataChanged(topLeft, bottomRight, roles);
-    qDebug() << topLeft << bottomRight << roles;
+    // values pushed by the server come row by row, column by column and role by role
+    QVariantList values = args.value(i++).toList();
+    QVector<int> valueRoles;
+    foreach (const QVariant &v, args.value(i++).toList()) {
+        valueRoles.append(v.toInt());
+    }
+    int width = right - left + 1;
+    // rows and cells nothing was cached for stay unallocated unless values come along
+    QVector<int> positions;
+    QVector<Row *> rows;
+    if (valueRoles.isEmpty())
+        rows = parentNode->rowRecords(top, bottom - top + 1, &positions);
+    else
+        rows = parentNode->rowRange(top, bottom - top + 1);
+    for (int k = 0; k < rows.count(); k++) {
+        Row *r = rows.at(k);
+        int row = positions.isEmpty() ? top + k : positions.at(k);
+        int last = valueRoles.isEmpty() ? qMin(right, r->cells.count() - 1) : right;
+        for (int column = left; column <= last; column++) {
+            Cell *cell = r->cell(column);
+            if (roles.isEmpty()) {
+                cell->values.clear();
+                cell->flags = -1;
+            } else {
+                foreach (int role, roles)
+                    cell->values.remove(role);
+            }
+            if (!valueRoles.isEmpty()) {
+                int offset = ((row - top) * width + column - left) * valueRoles.count();
+                for (int j = 0; j < valueRoles.count() && offset + j < values.count(); j++)
+                    cell->values.insert(valueRoles.at(j), values.at(offset + j));
+            }
+        }
+        // pushed values make a row recently used, invalidated ones only change its size
+        if (!valueRoles.isEmpty())
+            cache.insert(r);
+        else
+            cache.recount(r);
+    }
+    if (!valueRoles.isEmpty() && !rows.isEmpty())
+        cache.trim(rows.first());
+    emit q->dataChanged(q->createIndex(top, left, parentNode), q->createIndex(bottom, right, parentNode), roles);
 }
 
 void QRemoteModelClient::Private::headerDataChanged(const QVariantList &args)
@@ -332,139 +1485,195 @@ void QRemoteModelClient::Private::headerDataChanged(const QVariantList &args)
     Qt::Orientation orientation = static_cast<Qt::Orientation>(args.at(i++).toInt());
     int first = args.at(i++).toInt();
     int last = args.at(i++).toInt();
+    QMutableHashIterator<QPair<int, int>, QVariant> it(headerData[orientation - 1]);
+    while (it.hasNext()) {
+        it.next();
+        if (it.key().first >= first && it.key().first <= last)
+            it.remove();
+    }
     emit q->headerDataChanged(orientation, first, last);
 }
 
+// the rows may have been sorted or filtered, so neither the cached values
+// nor the shape hold at their positions any more; the new snapshot resets
+// the model like modelReset does
 void QRemoteModelClient::Private::layoutChanged(const QVariantList &args)
 {
     Q_UNUSED(args)
-    emit q->layoutChanged();
-//    Q_UNREACHABLE();
+    fetchStructure();
 }
 
 void QRemoteModelClient::Private::layoutAboutToBeChanged(const QVariantList &args)
 {
     Q_UNUSED(args)
-    emit q->layoutAboutToBeChanged();
-//    Q_UNREACHABLE();
 }
 
 void QRemoteModelClient::Private::rowsAboutToBeInserted(const QVariantList &args)
 {
     int i = 0;
-    QModelIndex parent = QtRemoteModel::toModelIndex(q, args.at(i++));
+    // a cell without children gets a node here, to be fetched on demand
+    Node *parentNode = nodeAt(args.at(i++), true);
     int first = args.at(i++).toInt();
     int last = args.at(i++).toInt();
-    q->beginInsertRows(parent, first, last);
+    if (!parentNode)
+        return;
+    if (!parentNode->fetched) {
+        parentNode->hasChildrenHint = true;
+        return;
+    }
+    if (lostTrack(first >= 0 && first <= last && first <= parentNode->rows.count(), "rowsAboutToBeInserted"))
+        return;
+    q->beginInsertRows(indexOf(parentNode), first, last);
 }
 
 void QRemoteModelClient::Private::rowsInserted(const QVariantList &args)
 {
     int i = 0;
-    QModelIndex parent = QtRemoteModel::toModelIndex(q, args.at(i++));
+    Node *parentNode = nodeAt(args.at(i++));
     int first = args.at(i++).toInt();
     int last = args.at(i++).toInt();
-    int count = last - first + 1;
-    Node *parentNode = parent.internalPointer() ? static_cast<Node *>(parent.internalPointer()) : rootNode;
-    int columnCount = 0;
-    if (parentNode->children.isEmpty()) {
-        columnCount = methodCall("columnCount", QVariantList() << QtRemoteModel::fromModelIndex(parent)).toInt();
-    } else {
-        columnCount = q->columnCount(parent);
-        foreach (Node *child, parentNode->children) {
-            if (child->row > first - 1) {
-                child->row += count;
-            }
-        }
-    }
-    for (int row = first; row <= last; row++) {
-        for (int column = 0; column < columnCount; column++) {
-            new Node(row, column, parentNode);
+    if (!parentNode || !parentNode->fetched)
+        return;
+    int columnCount = args.at(i++).toInt();
+    if (parentNode->rows.isEmpty())
+        parentNode->columnCount = columnCount;
+    parentNode->insertRows(first, last - first + 1);
+    QList<Node *> branches;
+    QVariantList points = args.value(i++).toList();
+    QVariantList handles = args.value(i++).toList();
+    for (int j = 0; j < points.count(); j++) {
+        QPoint point = points.at(j).toPoint();
+        Node *child = parentNode->child(point.y(), point.x(), true);
+        if (child) {
+            child->handle = handles.value(j).toUInt();
+            child->hasChildrenHint = true;
+            branches.append(child);
         }
     }
     parentNode->check(Q_FUNC_INFO, __LINE__);
     q->endInsertRows();
+    if (!lazy) {
+        foreach (Node *child, branches)
+            fetchChildren(indexOf(child));
+    }
+}
+
+// a fetched destination is known even when empty, as long as its columns
+// are known or can be taken from the source
+static bool knowsDestination(const Node *sourceParent, const Node *destinationParent)
+{
+    if (!destinationParent || !destinationParent->fetched)
+        return false;
+    return destinationParent->columnCount > 0 || (sourceParent && sourceParent->fetched);
 }
 
 void QRemoteModelClient::Private::rowsAboutToBeMoved(const QVariantList &args)
 {
     int i = 0;
-    QModelIndex sourceParent = QtRemoteModel::toModelIndex(q, args.at(i++));
+    Node *sourceParent = nodeAt(args.at(i++));
     int sourceFirst = args.at(i++).toInt();
     int sourceLast = args.at(i++).toInt();
-    QModelIndex destinationParent = QtRemoteModel::toModelIndex(q, args.at(i++));
+    Node *destinationParent = nodeAt(args.at(i++));
     int destinationRow = args.at(i++).toInt();
-    q->beginMoveRows(sourceParent, sourceFirst, sourceLast, destinationParent, destinationRow);
+    bool sourceKnown = sourceParent && sourceParent->fetched;
+    bool destinationKnown = knowsDestination(sourceParent, destinationParent);
+    bool valid = sourceFirst >= 0 && sourceFirst <= sourceLast && destinationRow >= 0;
+    if (sourceKnown)
+        valid = valid && sourceLast < sourceParent->rows.count();
+    if (destinationKnown)
+        valid = valid && destinationRow <= destinationParent->rows.count();
+    if (lostTrack(valid, "rowsAboutToBeMoved"))
+        return;
+    if (sourceKnown && destinationKnown) {
+        lostTrack(q->beginMoveRows(indexOf(sourceParent), sourceFirst, sourceLast, indexOf(destinationParent), destinationRow), "rowsAboutToBeMoved");
+    } else if (sourceKnown) {
+        // the rows leave the part of the tree mirrored here
+        q->beginRemoveRows(indexOf(sourceParent), sourceFirst, sourceLast);
+    } else if (destinationKnown) {
+        q->beginInsertRows(indexOf(destinationParent), destinationRow, destinationRow + sourceLast - sourceFirst);
+    }
 }
 
 void QRemoteModelClient::Private::rowsMoved(const QVariantList &args)
 {
     int i = 0;
-    QModelIndex sourceParent = QtRemoteModel::toModelIndex(q, args.at(i++));
+    Node *sourceParent = nodeAt(args.at(i++));
     int sourceFirst = args.at(i++).toInt();
     int sourceLast = args.at(i++).toInt();
     int count = sourceLast - sourceFirst + 1;
-    QModelIndex destinationParent = QtRemoteModel::toModelIndex(q, args.at(i++));
+    Node *destinationParent = nodeAt(args.at(i++));
     int destinationRow = args.at(i++).toInt();
+    bool sourceKnown = sourceParent && sourceParent->fetched;
+    bool destinationKnown = knowsDestination(sourceParent, destinationParent);
 
-    QList<Node *> nodes;
-    Node *parentNode = sourceParent.internalPointer() ? static_cast<Node *>(sourceParent.internalPointer()) : rootNode;
-    QMutableListIterator<Node *> it(parentNode->children);
-    while (it.hasNext()) {
-        Node *child = it.next();
-        if (child->row < sourceFirst) {
-            // nothing to do
-        } else if (child->row < sourceLast + 1) {
-            it.remove();
-            child->row = destinationRow + child->row - sourceFirst - count;
-            nodes.append(child);
-        } else {
-            child->row -= count;
-        }
+    QVector<QRemoteModelRowIndex::Item *> rows;
+    if (sourceKnown) {
+        rows = sourceParent->takeRows(sourceFirst, count);
+        sourceParent->check(Q_FUNC_INFO, __LINE__);
     }
 
-    parentNode = destinationParent.internalPointer() ? static_cast<Node *>(destinationParent.internalPointer()) : rootNode;
-    foreach (Node *node, parentNode->children) {
-        if (node->row > destinationRow - 1 - count) {
-            node->row += count;
+    if (destinationKnown) {
+        if (destinationParent->columnCount == 0)
+            destinationParent->columnCount = sourceParent->columnCount;
+        // destinationRow counts the moved rows when they move down in the same parent
+        if (sourceParent == destinationParent && destinationRow > sourceLast)
+            destinationRow -= count;
+        if (sourceKnown) {
+            foreach (QRemoteModelRowIndex::Item *item, rows) {
+                if (!item)
+                    continue;
+                Row *r = static_cast<Row *>(item);
+                r->parent = destinationParent;
+                foreach (const Cell &cell, r->cells) {
+                    if (cell.node)
+                        cell.node->parent = destinationParent;
+                }
+            }
+            destinationParent->insertRows(destinationRow, rows);
+            rows.clear();
+        } else {
+            destinationParent->insertRows(destinationRow, count);
         }
+        destinationParent->check(Q_FUNC_INFO, __LINE__);
+    } else if (destinationParent) {
+        // fetched again, columns and all
+        destinationParent->fetched = false;
+        destinationParent->hasChildrenHint = true;
     }
-    parentNode->children.append(nodes);
-    parentNode->check(Q_FUNC_INFO, __LINE__);
 
-    qDebug() << sourceParent << sourceFirst << sourceLast << destinationParent << destinationRow;
-    q->endMoveRows();
+    foreach (QRemoteModelRowIndex::Item *item, rows)
+        delete static_cast<Row *>(item);
+
+    if (sourceKnown && destinationKnown)
+        q->endMoveRows();
+    else if (sourceKnown)
+        q->endRemoveRows();
+    else if (destinationKnown)
+        q->endInsertRows();
 }
 
 void QRemoteModelClient::Private::rowsAboutToBeRemoved(const QVariantList &args)
 {
     int i = 0;
-    QModelIndex parent = QtRemoteModel::toModelIndex(q, args.at(i++));
+    Node *parentNode = nodeAt(args.at(i++));
     int first = args.at(i++).toInt();
     int last = args.at(i++).toInt();
-    q->beginRemoveRows(parent, first, last);
+    if (!parentNode || !parentNode->fetched)
+        return;
+    if (lostTrack(first >= 0 && first <= last && last < parentNode->rows.count(), "rowsAboutToBeRemoved"))
+        return;
+    q->beginRemoveRows(indexOf(parentNode), first, last);
 }
 
 void QRemoteModelClient::Private::rowsRemoved(const QVariantList &args)
 {
     int i = 0;
-    QModelIndex parent = QtRemoteModel::toModelIndex(q, args.at(i++));
+    Node *parentNode = nodeAt(args.at(i++));
     int first = args.at(i++).toInt();
     int last = args.at(i++).toInt();
-    int count = last - first + 1;
-    Node *parentNode = parent.internalPointer() ? static_cast<Node *>(parent.internalPointer()) : rootNode;
-    QMutableListIterator<Node *> it(parentNode->children);
-    while (it.hasNext()) {
-        Node *child = it.next();
-        if (child->row < first) {
-            // nothing to do
-        } else if (child->row < last + 1) {
-            it.remove();
-            delete child;
-        } else {
-            child->row -= count;
-        }
-    }
+    if (!parentNode || !parentNode->fetched)
+        return;
+    parentNode->removeRows(first, last - first + 1);
     parentNode->check(Q_FUNC_INFO, __LINE__);
     q->endRemoveRows();
 }
@@ -472,60 +1681,115 @@ void QRemoteModelClient::Private::rowsRemoved(const QVariantList &args)
 void QRemoteModelClient::Private::columnsAboutToBeInserted(const QVariantList &args)
 {
     int i = 0;
-    QModelIndex parent = QtRemoteModel::toModelIndex(q, args.at(i++));
+    Node *parentNode = nodeAt(args.at(i++));
     int first = args.at(i++).toInt();
     int last = args.at(i++).toInt();
-    q->beginInsertColumns(parent, first, last);
+    if (!parentNode || !parentNode->fetched)
+        return;
+    if (lostTrack(first >= 0 && first <= last && first <= parentNode->columnCount, "columnsAboutToBeInserted"))
+        return;
+    q->beginInsertColumns(indexOf(parentNode), first, last);
 }
 
 void QRemoteModelClient::Private::columnsInserted(const QVariantList &args)
 {
-    Q_UNUSED(args)
+    int i = 0;
+    Node *parentNode = nodeAt(args.at(i++));
+    int first = args.at(i++).toInt();
+    int last = args.at(i++).toInt();
+    if (!parentNode || !parentNode->fetched)
+        return;
+    parentNode->insertColumns(first, last - first + 1);
     q->endInsertColumns();
 }
 
 void QRemoteModelClient::Private::columnsAboutToBeMoved(const QVariantList &args)
 {
     int i = 0;
-    QModelIndex sourceParent = QtRemoteModel::toModelIndex(q, args.at(i++));
+    Node *sourceParent = nodeAt(args.at(i++));
     int sourceFirst = args.at(i++).toInt();
     int sourceLast = args.at(i++).toInt();
-    QModelIndex destinationParent = QtRemoteModel::toModelIndex(q, args.at(i++));
+    Node *destinationParent = nodeAt(args.at(i++));
     int destinationColumn = args.at(i++).toInt();
-    q->beginMoveColumns(sourceParent, sourceFirst, sourceLast, destinationParent, destinationColumn);
+    if (!sourceParent || !sourceParent->fetched || !destinationParent || !destinationParent->fetched)
+        return;
+    if (lostTrack(sourceFirst >= 0 && sourceFirst <= sourceLast && sourceLast < sourceParent->columnCount
+                  && destinationColumn >= 0 && destinationColumn <= destinationParent->columnCount, "columnsAboutToBeMoved"))
+        return;
+    lostTrack(q->beginMoveColumns(indexOf(sourceParent), sourceFirst, sourceLast, indexOf(destinationParent), destinationColumn), "columnsAboutToBeMoved");
 }
 
 void QRemoteModelClient::Private::columnsMoved(const QVariantList &args)
 {
-    Q_UNUSED(args)
+    int i = 0;
+    Node *sourceParent = nodeAt(args.at(i++));
+    int sourceFirst = args.at(i++).toInt();
+    int sourceLast = args.at(i++).toInt();
+    int count = sourceLast - sourceFirst + 1;
+    Node *destinationParent = nodeAt(args.at(i++));
+    int destinationColumn = args.at(i++).toInt();
+    if (!sourceParent || !sourceParent->fetched || !destinationParent || !destinationParent->fetched)
+        return;
+    if (sourceParent == destinationParent) {
+        sourceParent->moveColumns(sourceFirst, count, destinationColumn);
+    } else {
+        // the values come again on demand
+        sourceParent->removeColumns(sourceFirst, count);
+        destinationParent->insertColumns(destinationColumn, count);
+    }
     q->endMoveColumns();
 }
 
 void QRemoteModelClient::Private::columnsAboutToBeRemoved(const QVariantList &args)
 {
     int i = 0;
-    QModelIndex parent = QtRemoteModel::toModelIndex(q, args.at(i++));
+    Node *parentNode = nodeAt(args.at(i++));
     int first = args.at(i++).toInt();
     int last = args.at(i++).toInt();
-    q->beginRemoveColumns(parent, first, last);
+    if (!parentNode || !parentNode->fetched)
+        return;
+    if (lostTrack(first >= 0 && first <= last && last < parentNode->columnCount, "columnsAboutToBeRemoved"))
+        return;
+    q->beginRemoveColumns(indexOf(parentNode), first, last);
 }
 
 void QRemoteModelClient::Private::columnsRemoved(const QVariantList &args)
 {
-    Q_UNUSED(args)
+    int i = 0;
+    Node *parentNode = nodeAt(args.at(i++));
+    int first = args.at(i++).toInt();
+    int last = args.at(i++).toInt();
+    if (!parentNode || !parentNode->fetched)
+        return;
+    parentNode->removeColumns(first, last - first + 1);
     q->endRemoveColumns();
 }
 
 void QRemoteModelClient::Private::modelAboutToBeReset(const QVariantList &args)
 {
     Q_UNUSED(args)
-    q->beginResetModel();
+    // the whole reset happens once the new snapshot arrives
 }
 
 void QRemoteModelClient::Private::modelReset(const QVariantList &args)
 {
     Q_UNUSED(args)
-    q->endResetModel();
+    fetchStructure();
+}
+
+// the server already merged what it could into single begin and end pairs
+void QRemoteModelClient::Private::transaction(const QVariantList &args)
+{
+    foreach (const QVariant &change, args) {
+        QVariantList pair = change.toList();
+        int i = 0;
+        QByteArray signal = QRemoteModelProtocol::name(pair.value(i++).toInt());
+        if (signal.isEmpty() || signal == QByteArrayLiteral("transaction")) {
+            qCWarning(lcRemoteModel) << "unexpected change in transaction" << pair.value(0);
+            continue;
+        }
+        emitSignal(signal, pair.value(i++).toList());
+    }
 }
 
 QRemoteModelClient::QRemoteModelClient(QObject *parent)
@@ -541,32 +1805,124 @@ QRemoteModelClient::~QRemoteModelClient()
 
 void QRemoteModelClient::connectToHost(const QHostAddress &address, quint16 port)
 {
-    d->connectToHost(address, port);
-    d->waitForConnected();
+    QTcpSocket *socket = new QTcpSocket(d);
+    d->setSocket(socket);
+    socket->connectToHost(address, port);
+    if (socket->waitForConnected())
+        d->waitForRoleNames();
+}
+
+// a server on this host that listens with QRemoteModelServer::listen(name)
+void QRemoteModelClient::connectToServer(const QString &name)
+{
+    QLocalSocket *socket = new QLocalSocket(d);
+    d->setSocket(socket);
+    socket->connectToServer(name);
+    if (socket->waitForConnected())
+        d->waitForRoleNames();
+}
+
+// the model registered with QRemoteModelServer::registerModel(), over
+// the connection of client instead of one of its own
+void QRemoteModelClient::connectToModel(QRemoteModelClient *client, const QString &name)
+{
+    if (!client || client == this)
+        return;
+    d->setConnection(client->d, name);
+    if (client->d->socket && client->d->socket->isOpen())
+        d->waitForRoleNames();
+}
+
+bool QRemoteModelClient::isLazy() const
+{
+    return d->lazy;
+}
+
+void QRemoteModelClient::setLazy(bool lazy)
+{
+    if (d->lazy == lazy) return;
+    d->lazy = lazy;
+    emit lazyChanged(lazy);
+}
+
+bool QRemoteModelClient::streamingCompression() const
+{
+    return d->streamingCompression;
+}
+
+// asked for when connecting
+void QRemoteModelClient::setStreamingCompression(bool streamingCompression)
+{
+    if (d->streamingCompression == streamingCompression) return;
+    d->streamingCompression = streamingCompression;
+    emit streamingCompressionChanged(streamingCompression);
+}
+
+int QRemoteModelClient::maximumUpdateRate() const
+{
+    return d->maximumUpdateRate;
+}
+
+// asked for when connecting
+void QRemoteModelClient::setMaximumUpdateRate(int maximumUpdateRate)
+{
+    if (d->maximumUpdateRate == maximumUpdateRate) return;
+    d->maximumUpdateRate = maximumUpdateRate;
+    emit maximumUpdateRateChanged(maximumUpdateRate);
+}
+
+QVector<int> QRemoteModelClient::subscribedRoles() const
+{
+    return d->subscribedRoles;
+}
+
+// only the values of these roles are pushed, empty for all
+void QRemoteModelClient::setSubscribedRoles(const QVector<int> &subscribedRoles)
+{
+    if (d->subscribedRoles == subscribedRoles) return;
+    d->subscribedRoles = subscribedRoles;
+    if (!d->regions.isEmpty())
+        d->scheduleSubscription();
+    emit subscribedRolesChanged(subscribedRoles);
+}
+
+QVariantMap QRemoteModelClient::compressionStatistics() const
+{
+    return d->compressor.statistics();
+}
+
+qint64 QRemoteModelClient::cacheBudget() const
+{
+    return d->cache.budget;
+}
+
+// 0 or less keeps every value received
+void QRemoteModelClient::setCacheBudget(qint64 cacheBudget)
+{
+    if (d->cache.budget == cacheBudget) return;
+    d->cache.budget = cacheBudget;
+    d->cache.trim(Q_NULLPTR);
+    emit cacheBudgetChanged(cacheBudget);
+}
+
+QVariantMap QRemoteModelClient::cacheStatistics() const
+{
+    return d->cache.statistics();
 }
 
 QModelIndex QRemoteModelClient::index(int row, int column, const QModelIndex &parent) const
 {
     QModelIndex ret;
-    if (hasIndex(row, column, parent)) {
-        Node *parentNode = parent.internalPointer() ? static_cast<Node *>(parent.internalPointer()) : d->rootNode;
-        foreach (Node *childNode, parentNode->children) {
-            if (childNode->row == row && childNode->column == column) {
-                ret = createIndex(row, column, childNode);
-                break;
-            }
-        }
-    }
+    if (hasIndex(row, column, parent))
+        ret = createIndex(row, column, d->node(parent));
     return ret;
 }
 
 QModelIndex QRemoteModelClient::parent(const QModelIndex &child) const
 {
     QModelIndex ret;
-    if (child.isValid() && child.internalPointer()) {
-        Node *parentNode = static_cast<Node *>(child.internalPointer())->parent;
-        ret = createIndex(parentNode->row, parentNode->column, parentNode);
-    }
+    if (child.isValid() && child.internalPointer())
+        ret = d->indexOf(static_cast<Node *>(child.internalPointer()));
     return ret;
 }
 
@@ -578,81 +1934,142 @@ QModelIndex QRemoteModelClient::sibling(int row, int column, const QModelIndex &
 
 int QRemoteModelClient::rowCount(const QModelIndex &parent) const
 {
-    int ret = 0;
-    const Node *node = parent.internalPointer() ? static_cast<const Node *>(parent.internalPointer()) : d->rootNode;
-    foreach (const Node *child, node->children) {
-        ret = std::max(ret, child->row + 1);
-    }
-    qDebug() << parent << ret;
-    return ret;
+    const Node *node = d->node(parent);
+    return node ? node->rows.count() : 0;
 }
 
 int QRemoteModelClient::columnCount(const QModelIndex &parent) const
 {
-    int ret = 0;
-    Node *node = parent.internalPointer() ? static_cast<Node *>(parent.internalPointer()) : d->rootNode;
-    foreach (const Node *child, node->children) {
-        ret = std::max(ret, child->column + 1);
-    }
-    qDebug() << parent << ret;
-    return ret;
+    const Node *node = d->node(parent);
+    return !node || node->rows.isEmpty() ? 0 : node->columnCount;
 }
 
 bool QRemoteModelClient::hasChildren(const QModelIndex &parent) const
 {
-    Node *node = parent.internalPointer() ? static_cast<Node *>(parent.internalPointer()) : d->rootNode;
-    bool ret = !node->children.isEmpty();
-//    qDebug() << parent << ret;
-    return ret;
+    const Node *node = d->node(parent);
+    if (!node)
+        return false;
+    if (!node->fetched)
+        return node->hasChildrenHint;
+    return !node->rows.isEmpty() || node->canFetchMore;
 }
 
 QVariant QRemoteModelClient::data(const QModelIndex &index, int role) const
 {
-    return d->methodCall("data", QVariantList() << QtRemoteModel::fromModelIndex(index) << role);
+    QVariant ret;
+    if (index.isValid() && index.internalPointer()) {
+        Row *row = d->rowOf(index);
+        const Cell *cell = row ? row->constCell(index.column()) : Q_NULLPTR;
+        QHash<int, QVariant>::const_iterator it;
+        if (cell && (it = cell->values.constFind(role)) != cell->values.constEnd()) {
+            ret = it.value();
+            d->cache.hit(row);
+        } else {
+            d->cache.miss();
+            d->fetchData(index, role);
+        }
+    }
+    return ret;
 }
 
 QVariant QRemoteModelClient::headerData(int section, Qt::Orientation orientation, int role) const
 {
-    return d->methodCall("headerData", QVariantList() << section << orientation << role);
+    QVariant ret;
+    QPair<int, int> key(section, role);
+    QHash<QPair<int, int>, QVariant>::const_iterator it = d->headerData[orientation - 1].constFind(key);
+    if (it != d->headerData[orientation - 1].constEnd())
+        ret = it.value();
+    else
+        d->fetchHeaderData(section, orientation, role);
+    return ret;
 }
 
 QMap<int, QVariant> QRemoteModelClient::itemData(const QModelIndex &index) const
 {
     QMap<int,QVariant> ret;
-    QMap<QString, QVariant> hash = d->methodCall("itemData", QVariantList() << QtRemoteModel::fromModelIndex(index)).toMap();
-    QMapIterator<QString, QVariant> i(hash);
-    while (i.hasNext()) {
-        i.next();
-        ret.insert(i.key().toInt(), i.value());
+    foreach (int role, d->roleNames.keys()) {
+        QVariant value = data(index, role);
+        if (value.isValid())
+            ret.insert(role, value);
     }
     return ret;
 }
 
+void QRemoteModelClient::fetchRange(const QModelIndex &parent, int first, int last, const QVector<int> &roles)
+{
+    d->fetchRange(parent, first, last, roles.isEmpty() ? d->roleNames.keys().toVector() : roles);
+}
+
+// replaces the region below parent; views call this as they scroll or
+// expand, structural changes still reach every client
+void QRemoteModelClient::subscribe(const QModelIndex &parent, int first, int last)
+{
+    Private::Region region;
+    region.parent = parent;
+    region.root = !parent.isValid();
+    region.first = qMax(0, first);
+    region.last = last;
+    for (int i = 0; i < d->regions.count(); i++) {
+        if (d->regions.at(i).below(parent)) {
+            d->regions[i] = region;
+            d->scheduleSubscription();
+            return;
+        }
+    }
+    d->regions.append(region);
+    d->scheduleSubscription();
+}
+
+// without regions left every change is sent again
+void QRemoteModelClient::unsubscribe(const QModelIndex &parent)
+{
+    for (int i = 0; i < d->regions.count(); i++) {
+        if (d->regions.at(i).below(parent)) {
+            d->regions.removeAt(i);
+            d->scheduleSubscription();
+            return;
+        }
+    }
+}
+
+// the callback gets an invalid value when the server does not know the method
+void QRemoteModelClient::call(const QByteArray &method, const QVariantList &args, const std::function<void(const QVariant &)> &callback)
+{
+    d->invoke(method, args, callback);
+}
+
 void QRemoteModelClient::fetchMore(const QModelIndex &parent)
 {
-    d->methodCall("fetchMore", QVariantList() << QtRemoteModel::fromModelIndex(parent));
+    d->fetchMore(parent);
 }
 
 bool QRemoteModelClient::canFetchMore(const QModelIndex &parent) const
 {
-    return d->methodCall("canFetchMore", QVariantList() << QtRemoteModel::fromModelIndex(parent)).toBool();
+    const Node *node = d->node(parent);
+    if (!node)
+        return false;
+    if (!node->fetched)
+        return node->hasChildrenHint && !node->fetching;
+    return node->canFetchMore;
 }
 
 Qt::ItemFlags QRemoteModelClient::flags(const QModelIndex &index) const
 {
-    return static_cast<Qt::ItemFlags>(d->methodCall("flags", QVariantList() << QtRemoteModel::fromModelIndex(index)).toInt());
+    Qt::ItemFlags ret = Qt::ItemIsSelectable | Qt::ItemIsEnabled;
+    if (index.isValid() && index.internalPointer()) {
+        const Row *row = d->rowOf(index);
+        const Cell *cell = row ? row->constCell(index.column()) : Q_NULLPTR;
+        if (!cell || cell->flags < 0)
+            d->fetchFlags(index);
+        else
+            ret = static_cast<Qt::ItemFlags>(cell->flags);
+    }
+    return ret;
 }
 
 QHash<int,QByteArray> QRemoteModelClient::roleNames() const
 {
-    QHash<int,QByteArray> ret;
-    QHash<QString, QVariant> hash = d->methodCall("roleNames").toHash();
-    QHashIterator<QString, QVariant> i(hash);
-    while (i.hasNext()) {
-        i.next();
-        ret.insert(i.key().toInt(), i.value().toByteArray());
-    }
-    return ret;
+    return d->roleNames;
 }
 
 #include "qremotemodelclient.moc"
@@ -30,16 +30,46 @@
 #include "qtremotemodel_global.h"
 #include <QtCore/QAbstractItemModel>
 
+#include <functional>
+
 class QHostAddress;
 
 class QTREMOTEMODEL_EXPORT QRemoteModelClient : public QAbstractItemModel
 {
     Q_OBJECT
+    Q_PROPERTY(bool lazy READ isLazy WRITE setLazy NOTIFY lazyChanged)
+    Q_PROPERTY(bool streamingCompression READ streamingCompression WRITE setStreamingCompression NOTIFY streamingCompressionChanged)
+    Q_PROPERTY(qint64 cacheBudget READ cacheBudget WRITE setCacheBudget NOTIFY cacheBudgetChanged)
+    Q_PROPERTY(int maximumUpdateRate READ maximumUpdateRate WRITE setMaximumUpdateRate NOTIFY maximumUpdateRateChanged)
+    Q_PROPERTY(QVector<int> subscribedRoles READ subscribedRoles WRITE setSubscribedRoles NOTIFY subscribedRolesChanged)
 public:
     explicit QRemoteModelClient(QObject *parent = 0);
     ~QRemoteModelClient();
 
     void connectToHost(const QHostAddress &address, quint16 port);
+    void connectToServer(const QString &name);
+    Q_INVOKABLE void connectToModel(QRemoteModelClient *client, const QString &name);
+
+    bool isLazy() const;
+    bool streamingCompression() const;
+    // bytes of cached values, roughly, before the least recently used go
+    qint64 cacheBudget() const;
+    // updates of the same cells per second, 0 takes every one
+    int maximumUpdateRate() const;
+    // roles whose values the server pushes, empty for all
+    QVector<int> subscribedRoles() const;
+
+    Q_INVOKABLE QVariantMap compressionStatistics() const;
+    Q_INVOKABLE QVariantMap cacheStatistics() const;
+
+    void fetchRange(const QModelIndex &parent, int first, int last, const QVector<int> &roles = QVector<int>());
+    // value changes only for the rows the views show, first to last below
+    // parent and everything below them; last -1 for all rows
+    Q_INVOKABLE void subscribe(const QModelIndex &parent, int first, int last = -1);
+    Q_INVOKABLE void unsubscribe(const QModelIndex &parent = QModelIndex());
+    // calls a method registered with QRemoteModelServer::registerMethod()
+    void call(const QByteArray &method, const QVariantList &args = QVariantList(),
+              const std::function<void(const QVariant &value)> &callback = std::function<void(const QVariant &value)>());
 
     virtual QModelIndex index(int row, int column,
                               const QModelIndex &parent = QModelIndex()) const;
@@ -63,6 +93,21 @@ public:
 
     virtual QHash<int,QByteArray> roleNames() const;
 
+public Q_SLOTS:
+    void setLazy(bool lazy);
+    void setStreamingCompression(bool streamingCompression);
+    void setCacheBudget(qint64 cacheBudget);
+    void setMaximumUpdateRate(int maximumUpdateRate);
+    void setSubscribedRoles(const QVector<int> &subscribedRoles);
+
+signals:
+    void lazyChanged(bool lazy);
+    void streamingCompressionChanged(bool streamingCompression);
+    void cacheBudgetChanged(qint64 cacheBudget);
+    void maximumUpdateRateChanged(int maximumUpdateRate);
+    void subscribedRolesChanged(const QVector<int> &subscribedRoles);
+    void rangeFetched(const QModelIndex &parent, int first, int last);
+
 private:
     class Private;
     mutable Private *d;
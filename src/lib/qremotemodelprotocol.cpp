@@ -0,0 +1,698 @@
+/* Copyright (c) 2015 Tasuku Suzuki.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Tasuku Suzuki nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL TASUKU SUZUKI BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "qremotemodelprotocol_p.h"
+
+#include <QtCore/QDataStream>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
+#include <QtCore/QIODevice>
+#include <QtCore/QPoint>
+#include <QtCore/QtEndian>
+
+#include <cstring>
+
+#include <zlib.h>
+
+// Version 1 frames carry a qCompress'ed QDataStream of the request id,
+// the call type, the method name and a QVariantList of arguments.
+//
+// Version 2 frames are flagged with BinaryFrame and carry
+//   type:byte id:varint opcode:byte [name] argc:varint args...
+// for calls and signals, and
+//   type:byte id:varint value
+// for returns. Each value starts with one of the tags below; index paths
+// and role lists get packed encodings and anything else falls back to
+// QDataStream.
+//
+// Binary frames of at least QRemoteModelCompressor::threshold bytes are
+// compressed and flagged with CompressedFrame when that makes them
+// smaller. A connection can agree on a streaming zlib context for the
+// frames the server sends, which lets small and repetitive signal frames
+// refer to the ones before them.
+//
+// Version 3 encodes like version 2 and adds the transaction signal, which
+// carries the changes the server coalesced as opcode and argument list
+// pairs, the resume and release calls, and the shared return: clients on
+// the same host get large answers in a shared memory segment, named in
+// the frame together with the length of the payload it holds.
+//
+// Calls and signals of another model than the default one, opened with
+// the open call of version 3, end with the channel number of that model.
+//
+// The id of a signal is its sequence number on the server, 0 when it was
+// not numbered. A client that reconnects to the same server instance can
+// resume after the last one it applied as long as the server still
+// journals the changes since.
+
+Q_LOGGING_CATEGORY(lcRemoteModel, "qt.remotemodel")
+
+namespace {
+
+enum Tag {
+    NullTag,
+    FalseTag,
+    TrueTag,
+    IntTag,
+    DoubleTag,
+    StringTag,
+    ByteArrayTag,
+    PathTag,
+    IntListTag,
+    ListTag,
+    VariantTag,
+    UIntTag
+};
+
+struct OpcodeName
+{
+    quint8 opcode;
+    const char *name;
+};
+
+const OpcodeName opcodeNames[] = {
+    { QRemoteModelProtocol::Hello, "hello" },
+    { QRemoteModelProtocol::Index, "index" },
+    { QRemoteModelProtocol::Parent, "parent" },
+    { QRemoteModelProtocol::ColumnCount, "columnCount" },
+    { QRemoteModelProtocol::RowCount, "rowCount" },
+    { QRemoteModelProtocol::Data, "data" },
+    { QRemoteModelProtocol::CanFetchMore, "canFetchMore" },
+    { QRemoteModelProtocol::Flags, "flags" },
+    { QRemoteModelProtocol::Buddy, "buddy" },
+    { QRemoteModelProtocol::HeaderData, "headerData" },
+    { QRemoteModelProtocol::HasChildren, "hasChildren" },
+    { QRemoteModelProtocol::Submit, "submit" },
+    { QRemoteModelProtocol::FetchMore, "fetchMore" },
+    { QRemoteModelProtocol::Sibling, "sibling" },
+    { QRemoteModelProtocol::RoleNames, "roleNames" },
+    { QRemoteModelProtocol::Structure, "structure" },
+    { QRemoteModelProtocol::RangeData, "rangeData" },
+    { QRemoteModelProtocol::ItemData, "itemData" },
+    { QRemoteModelProtocol::Resume, "resume" },
+    { QRemoteModelProtocol::Release, "release" },
+    { QRemoteModelProtocol::Open, "open" },
+    { QRemoteModelProtocol::Subscribe, "subscribe" },
+
+    { QRemoteModelProtocol::DataChanged, "dataChanged" },
+    { QRemoteModelProtocol::HeaderDataChanged, "headerDataChanged" },
+    { QRemoteModelProtocol::LayoutChanged, "layoutChanged" },
+    { QRemoteModelProtocol::LayoutAboutToBeChanged, "layoutAboutToBeChanged" },
+    { QRemoteModelProtocol::RowsAboutToBeInserted, "rowsAboutToBeInserted" },
+    { QRemoteModelProtocol::RowsInserted, "rowsInserted" },
+    { QRemoteModelProtocol::RowsAboutToBeMoved, "rowsAboutToBeMoved" },
+    { QRemoteModelProtocol::RowsMoved, "rowsMoved" },
+    { QRemoteModelProtocol::RowsAboutToBeRemoved, "rowsAboutToBeRemoved" },
+    { QRemoteModelProtocol::RowsRemoved, "rowsRemoved" },
+    { QRemoteModelProtocol::ColumnsAboutToBeInserted, "columnsAboutToBeInserted" },
+    { QRemoteModelProtocol::ColumnsInserted, "columnsInserted" },
+    { QRemoteModelProtocol::ColumnsAboutToBeMoved, "columnsAboutToBeMoved" },
+    { QRemoteModelProtocol::ColumnsMoved, "columnsMoved" },
+    { QRemoteModelProtocol::ColumnsAboutToBeRemoved, "columnsAboutToBeRemoved" },
+    { QRemoteModelProtocol::ColumnsRemoved, "columnsRemoved" },
+    { QRemoteModelProtocol::ModelAboutToBeReset, "modelAboutToBeReset" },
+    { QRemoteModelProtocol::ModelReset, "modelReset" },
+    { QRemoteModelProtocol::Transaction, "transaction" }
+};
+
+class OpcodeTable
+{
+public:
+    OpcodeTable() {
+        for (size_t i = 0; i < sizeof(opcodeNames) / sizeof(opcodeNames[0]); i++) {
+            QByteArray name(opcodeNames[i].name);
+            opcodes.insert(name, opcodeNames[i].opcode);
+            names.insert(opcodeNames[i].opcode, name);
+        }
+    }
+
+    QHash<QByteArray, quint8> opcodes;
+    QHash<quint8, QByteArray> names;
+};
+
+Q_GLOBAL_STATIC(OpcodeTable, opcodeTable)
+
+void writeVarint(QByteArray &out, quint64 value)
+{
+    while (value >= 0x80) {
+        out.append(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.append(static_cast<char>(value));
+}
+
+quint64 zigzag(qint64 value)
+{
+    return (static_cast<quint64>(value) << 1) ^ static_cast<quint64>(value >> 63);
+}
+
+qint64 unzigzag(quint64 value)
+{
+    return static_cast<qint64>(value >> 1) ^ -static_cast<qint64>(value & 1);
+}
+
+// (column, row) points, optionally starting with a node handle
+bool isPath(const QVariantList &list)
+{
+    if (list.isEmpty())
+        return false;
+    for (int i = 0; i < list.count(); i++) {
+        const QVariant &value = list.at(i);
+        if (i == 0 && value.type() == QVariant::UInt && value.toUInt() != 0)
+            continue;
+        if (value.type() != QVariant::Point)
+            return false;
+        QPoint point = value.toPoint();
+        if (point.x() < 0 || point.y() < 0)
+            return false;
+    }
+    return true;
+}
+
+bool isIntList(const QVariantList &list)
+{
+    if (list.isEmpty())
+        return false;
+    foreach (const QVariant &value, list) {
+        if (value.type() != QVariant::Int)
+            return false;
+    }
+    return true;
+}
+
+void writeValue(QByteArray &out, const QVariant &value)
+{
+    switch (value.type()) {
+    case QVariant::Invalid:
+        out.append(static_cast<char>(NullTag));
+        break;
+    case QVariant::Bool:
+        out.append(static_cast<char>(value.toBool() ? TrueTag : FalseTag));
+        break;
+    case QVariant::Int:
+        out.append(static_cast<char>(IntTag));
+        writeVarint(out, zigzag(value.toInt()));
+        break;
+    case QVariant::UInt:
+        out.append(static_cast<char>(UIntTag));
+        writeVarint(out, value.toUInt());
+        break;
+    case QVariant::Double: {
+        double d = value.toDouble();
+        quint64 bits;
+        std::memcpy(&bits, &d, sizeof(bits));
+        uchar buffer[sizeof(bits)];
+        qToLittleEndian(bits, buffer);
+        out.append(static_cast<char>(DoubleTag));
+        out.append(reinterpret_cast<const char *>(buffer), sizeof(buffer));
+        break; }
+    case QVariant::String: {
+        QByteArray utf8 = value.toString().toUtf8();
+        out.append(static_cast<char>(StringTag));
+        writeVarint(out, utf8.length());
+        out.append(utf8);
+        break; }
+    case QVariant::ByteArray: {
+        QByteArray data = value.toByteArray();
+        out.append(static_cast<char>(ByteArrayTag));
+        writeVarint(out, data.length());
+        out.append(data);
+        break; }
+    case QVariant::List: {
+        const QVariantList list = value.toList();
+        if (isPath(list)) {
+            quint32 handle = list.first().type() == QVariant::UInt ? list.first().toUInt() : 0;
+            out.append(static_cast<char>(PathTag));
+            writeVarint(out, handle);
+            writeVarint(out, handle ? list.count() - 1 : list.count());
+            foreach (const QVariant &v, handle ? list.mid(1) : list) {
+                QPoint point = v.toPoint();
+                writeVarint(out, point.y());
+                writeVarint(out, point.x());
+            }
+        } else if (isIntList(list)) {
+            out.append(static_cast<char>(IntListTag));
+            writeVarint(out, list.count());
+            foreach (const QVariant &v, list)
+                writeVarint(out, zigzag(v.toInt()));
+        } else {
+            out.append(static_cast<char>(ListTag));
+            writeVarint(out, list.count());
+            foreach (const QVariant &v, list)
+                writeValue(out, v);
+        }
+        break; }
+    default: {
+        QByteArray data;
+        {
+            QDataStream stream(&data, QIODevice::WriteOnly);
+            stream << value;
+        }
+        out.append(static_cast<char>(VariantTag));
+        writeVarint(out, data.length());
+        out.append(data);
+        break; }
+    }
+}
+
+class Reader
+{
+public:
+    explicit Reader(const QByteArray &data)
+        : data(data.constData()), end(data.constData() + data.length()), depth(0), ok(true) {}
+
+    // lists within lists deeper than any message has them mean a hostile
+    // frame, which would otherwise run the stack out
+    enum { MaximumDepth = 32 };
+
+    quint8 byte() {
+        if (data >= end) {
+            ok = false;
+            return 0;
+        }
+        return static_cast<quint8>(*data++);
+    }
+
+    bool atEnd() const { return data >= end; }
+
+    quint64 varint() {
+        quint64 ret = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            quint8 b = byte();
+            if (!ok)
+                return 0;
+            ret |= static_cast<quint64>(b & 0x7f) << shift;
+            if (!(b & 0x80))
+                return ret;
+        }
+        ok = false;
+        return 0;
+    }
+
+    // counts can never exceed the bytes left, which keeps a corrupt
+    // frame from reserving huge lists
+    int count() {
+        quint64 ret = varint();
+        if (ret > static_cast<quint64>(end - data)) {
+            ok = false;
+            return 0;
+        }
+        return static_cast<int>(ret);
+    }
+
+    const char *take(int length) {
+        if (length < 0 || length > end - data) {
+            ok = false;
+            return Q_NULLPTR;
+        }
+        const char *ret = data;
+        data += length;
+        return ret;
+    }
+
+    QVariant value() {
+        switch (byte()) {
+        case NullTag:
+            return QVariant();
+        case FalseTag:
+            return false;
+        case TrueTag:
+            return true;
+        case IntTag:
+            return static_cast<int>(unzigzag(varint()));
+        case UIntTag:
+            return static_cast<uint>(varint());
+        case DoubleTag: {
+            const char *p = take(sizeof(quint64));
+            if (!p)
+                return QVariant();
+            quint64 bits = qFromLittleEndian<quint64>(reinterpret_cast<const uchar *>(p));
+            double d;
+            std::memcpy(&d, &bits, sizeof(d));
+            return d; }
+        case StringTag: {
+            int length = count();
+            const char *p = take(length);
+            return p ? QString::fromUtf8(p, length) : QString(); }
+        case ByteArrayTag: {
+            int length = count();
+            const char *p = take(length);
+            return p ? QByteArray(p, length) : QByteArray(); }
+        case PathTag: {
+            quint32 handle = static_cast<quint32>(varint());
+            int length = count();
+            QVariantList ret;
+            ret.reserve(length + 1);
+            if (handle)
+                ret.append(handle);
+            for (int i = 0; i < length && ok; i++) {
+                int row = static_cast<int>(varint());
+                int column = static_cast<int>(varint());
+                ret.append(QPoint(column, row));
+            }
+            return ret; }
+        case IntListTag: {
+            int length = count();
+            QVariantList ret;
+            ret.reserve(length);
+            for (int i = 0; i < length && ok; i++)
+                ret.append(static_cast<int>(unzigzag(varint())));
+            return ret; }
+        case ListTag: {
+            if (depth >= MaximumDepth) {
+                ok = false;
+                return QVariant();
+            }
+            int length = count();
+            QVariantList ret;
+            ret.reserve(length);
+            depth++;
+            for (int i = 0; i < length && ok; i++)
+                ret.append(value());
+            depth--;
+            return ret; }
+        case VariantTag: {
+            int length = count();
+            const char *p = take(length);
+            QVariant ret;
+            if (p) {
+                QByteArray raw = QByteArray::fromRawData(p, length);
+                QDataStream stream(raw);
+                stream >> ret;
+            }
+            return ret; }
+        default:
+            ok = false;
+            return QVariant();
+        }
+    }
+
+    const char *data;
+    const char *end;
+    int depth;
+    bool ok;
+};
+
+}
+
+QRemoteModelMessage::QRemoteModelMessage()
+    : type(QtRemoteModel::MethodCall)
+    , id(0)
+    , opcode(QRemoteModelProtocol::InvalidOpcode)
+    , channel(0)
+{
+}
+
+QRemoteModelZStream::QRemoteModelZStream(Mode mode, int level)
+    : mode(mode)
+    , stream(new z_stream)
+{
+    std::memset(stream, 0, sizeof(z_stream));
+    if (mode == Deflate)
+        deflateInit(stream, level);
+    else
+        inflateInit(stream);
+}
+
+QRemoteModelZStream::~QRemoteModelZStream()
+{
+    if (mode == Deflate)
+        deflateEnd(stream);
+    else
+        inflateEnd(stream);
+    delete stream;
+}
+
+QByteArray QRemoteModelZStream::process(const QByteArray &data, bool *ok)
+{
+    QByteArray ret;
+    int chunk = qMax(256, mode == Deflate ? data.length() : data.length() * 4);
+    int written = 0;
+    stream->next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.constData()));
+    stream->avail_in = data.length();
+    forever {
+        ret.resize(written + chunk);
+        stream->next_out = reinterpret_cast<Bytef *>(ret.data() + written);
+        stream->avail_out = chunk;
+        int err = mode == Deflate ? ::deflate(stream, Z_SYNC_FLUSH) : ::inflate(stream, Z_SYNC_FLUSH);
+        written += chunk - stream->avail_out;
+        if (err != Z_OK && err != Z_BUF_ERROR) {
+            *ok = false;
+            return QByteArray();
+        }
+        // the flush is complete once zlib stops filling the whole buffer
+        if (stream->avail_out != 0)
+            break;
+    }
+    ret.resize(written);
+    *ok = stream->avail_in == 0;
+    return ret;
+}
+
+QRemoteModelCompressor::QRemoteModelCompressor()
+    : threshold(512)
+    , level(-1)
+    , framesSent(0)
+    , framesCompressed(0)
+    , bytesIn(0)
+    , bytesOut(0)
+    , deflateTime(0)
+    , framesInflated(0)
+    , inflateTime(0)
+{
+}
+
+QByteArray QRemoteModelCompressor::deflate(const QByteArray &payload, int *flags, QRemoteModelZStream *stream)
+{
+    QByteArray ret = payload;
+    framesSent++;
+    bytesIn += payload.length();
+    // a streaming context makes even small frames worth it, and whatever
+    // went through it has to be sent so both ends stay in sync
+    if (level != 0 && (stream || payload.length() >= threshold)) {
+        QElapsedTimer timer;
+        timer.start();
+        bool ok = true;
+        QByteArray compressed = stream ? stream->process(payload, &ok) : qCompress(payload, level);
+        deflateTime += timer.nsecsElapsed();
+        if (ok && (stream || compressed.length() < payload.length())) {
+            ret = compressed;
+            *flags |= QRemoteModelProtocol::CompressedFrame;
+            framesCompressed++;
+        }
+    }
+    bytesOut += ret.length();
+    return ret;
+}
+
+QByteArray QRemoteModelCompressor::inflate(const QByteArray &payload, bool *ok, QRemoteModelZStream *stream)
+{
+    QElapsedTimer timer;
+    timer.start();
+    QByteArray ret;
+    if (stream) {
+        ret = stream->process(payload, ok);
+    } else {
+        ret = qUncompress(payload);
+        *ok = !ret.isEmpty();
+    }
+    inflateTime += timer.nsecsElapsed();
+    framesInflated++;
+    return ret;
+}
+
+QVariantMap QRemoteModelCompressor::statistics() const
+{
+    QVariantMap ret;
+    ret.insert(QStringLiteral("framesSent"), framesSent);
+    ret.insert(QStringLiteral("framesCompressed"), framesCompressed);
+    ret.insert(QStringLiteral("bytesIn"), bytesIn);
+    ret.insert(QStringLiteral("bytesOut"), bytesOut);
+    ret.insert(QStringLiteral("ratio"), bytesIn > 0 ? double(bytesOut) / bytesIn : 1.0);
+    ret.insert(QStringLiteral("deflateTime"), deflateTime / 1000000.0);
+    ret.insert(QStringLiteral("framesInflated"), framesInflated);
+    ret.insert(QStringLiteral("inflateTime"), inflateTime / 1000000.0);
+    return ret;
+}
+
+quint8 QRemoteModelProtocol::opcode(const QByteArray &name)
+{
+    return opcodeTable()->opcodes.value(name, ExtensionOpcode);
+}
+
+QByteArray QRemoteModelProtocol::name(quint8 opcode)
+{
+    return opcodeTable()->names.value(opcode);
+}
+
+QByteArray QRemoteModelProtocol::frame(const QByteArray &payload, int version, QRemoteModelCompressor *compressor, QRemoteModelZStream *stream)
+{
+    if (payload.length() > MaximumFrameSize)
+        qCWarning(lcRemoteModel) << "frame of" << payload.length() << "bytes exceeds the maximum, the peer will drop the connection";
+    if (version == Version1) {
+        QByteArray ret = QtRemoteModel::encodeHeader(payload.length());
+        ret.append(payload);
+        return ret;
+    }
+    int flags = BinaryFrame;
+    QByteArray data = compressor ? compressor->deflate(payload, &flags, stream) : payload;
+    QByteArray ret = QtRemoteModel::encodeHeader(data.length(), flags);
+    ret.append(data);
+    return ret;
+}
+
+QByteArray QRemoteModelProtocol::frame(const QRemoteModelMessage &message, int version, QRemoteModelCompressor *compressor, QRemoteModelZStream *stream)
+{
+    return frame(encode(message, version), version, compressor, stream);
+}
+
+QRemoteModelProtocol::FrameStatus QRemoteModelProtocol::readFrame(QIODevice *device, QRemoteModelMessage *message, QRemoteModelCompressor *compressor, QRemoteModelZStream *stream)
+{
+    if (device->bytesAvailable() < QtRemoteModel::HeaderLength)
+        return NoFrame;
+    int flags = 0;
+    qint64 length = QtRemoteModel::decodeHeader(device->peek(QtRemoteModel::HeaderLength), &flags);
+    // checked before anything is buffered for it
+    if (length > MaximumFrameSize) {
+        qCWarning(lcRemoteModel) << "frame of" << length << "bytes exceeds the maximum";
+        return BrokenFrame;
+    }
+    if (device->bytesAvailable() < QtRemoteModel::HeaderLength + length)
+        return NoFrame;
+    device->read(QtRemoteModel::HeaderLength);
+    QByteArray data = device->read(length);
+    bool ok = true;
+    if (flags & CompressedFrame) {
+        if (compressor) {
+            data = compressor->inflate(data, &ok, stream);
+        } else {
+            data = qUncompress(data);
+            ok = !data.isEmpty();
+        }
+    }
+    if (!ok || !decode(data, flags, message)) {
+        qCWarning(lcRemoteModel) << "broken frame of" << length << "bytes";
+        return BrokenFrame;
+    }
+    return FrameRead;
+}
+
+QByteArray QRemoteModelProtocol::encode(const QRemoteModelMessage &message, int version)
+{
+    QByteArray ret;
+    if (version == Version1) {
+        {
+            QDataStream stream(&ret, QIODevice::WriteOnly);
+            stream << message.id;
+            stream << message.type;
+            switch (message.type) {
+            case QtRemoteModel::MethodCall:
+            case QtRemoteModel::EmitSignal:
+                stream << message.name;
+                stream << message.args;
+                break;
+            default:
+                stream << message.value;
+                break;
+            }
+        }
+        return qCompress(ret);
+    }
+
+    ret.append(static_cast<char>(message.type));
+    writeVarint(ret, message.id);
+    switch (message.type) {
+    case QtRemoteModel::MethodCall:
+    case QtRemoteModel::EmitSignal: {
+        quint8 code = message.opcode != InvalidOpcode ? message.opcode : opcode(message.name);
+        ret.append(static_cast<char>(code));
+        if (code == ExtensionOpcode) {
+            writeVarint(ret, message.name.length());
+            ret.append(message.name);
+        }
+        writeVarint(ret, message.args.count());
+        foreach (const QVariant &arg, message.args)
+            writeValue(ret, arg);
+        if (message.channel)
+            writeVarint(ret, message.channel);
+        break; }
+    default:
+        writeValue(ret, message.value);
+        break;
+    }
+    return ret;
+}
+
+bool QRemoteModelProtocol::decode(const QByteArray &data, int flags, QRemoteModelMessage *message)
+{
+    if (!(flags & BinaryFrame)) {
+        QDataStream stream(qUncompress(data));
+        int type;
+        stream >> message->id;
+        stream >> type;
+        message->type = static_cast<QtRemoteModel::CallType>(type);
+        switch (message->type) {
+        case QtRemoteModel::MethodCall:
+        case QtRemoteModel::EmitSignal:
+            stream >> message->name;
+            stream >> message->args;
+            message->opcode = opcode(message->name);
+            break;
+        default:
+            stream >> message->value;
+            break;
+        }
+        return stream.status() == QDataStream::Ok;
+    }
+
+    Reader reader(data);
+    message->type = static_cast<QtRemoteModel::CallType>(reader.byte());
+    message->id = static_cast<quint32>(reader.varint());
+    switch (message->type) {
+    case QtRemoteModel::MethodCall:
+    case QtRemoteModel::EmitSignal: {
+        message->opcode = reader.byte();
+        if (message->opcode == ExtensionOpcode) {
+            int length = reader.count();
+            const char *name = reader.take(length);
+            if (name)
+                message->name = QByteArray(name, length);
+        } else {
+            message->name = QRemoteModelProtocol::name(message->opcode);
+        }
+        int argc = reader.count();
+        message->args.reserve(argc);
+        for (int i = 0; i < argc && reader.ok; i++)
+            message->args.append(reader.value());
+        if (reader.ok && !reader.atEnd())
+            message->channel = static_cast<quint32>(reader.varint());
+        break; }
+    default:
+        message->value = reader.value();
+        break;
+    }
+    return reader.ok;
+}
@@ -0,0 +1,193 @@
+/* Copyright (c) 2015 Tasuku Suzuki.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Tasuku Suzuki nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL TASUKU SUZUKI BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef QREMOTEMODELPROTOCOL_P_H
+#define QREMOTEMODELPROTOCOL_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QtRemoteModel API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include "qtremotemodel_global.h"
+
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QVariant>
+
+class QIODevice;
+struct z_stream_s;
+
+Q_DECLARE_LOGGING_CATEGORY(lcRemoteModel)
+
+class QRemoteModelMessage
+{
+public:
+    QRemoteModelMessage();
+
+    QtRemoteModel::CallType type;
+    quint32 id;
+    quint8 opcode;
+    QByteArray name;
+    // arguments of a method call or a signal
+    QVariantList args;
+    // the model of a call or signal, 0 for the default one
+    quint32 channel;
+    // result of a method return
+    QVariant value;
+};
+
+// zlib context kept across the frames of one connection
+class QRemoteModelZStream
+{
+public:
+    enum Mode { Deflate, Inflate };
+
+    explicit QRemoteModelZStream(Mode mode, int level = -1);
+    ~QRemoteModelZStream();
+
+    QByteArray process(const QByteArray &data, bool *ok);
+
+private:
+    Q_DISABLE_COPY(QRemoteModelZStream)
+    Mode mode;
+    z_stream_s *stream;
+};
+
+// compresses binary frames which are worth it and keeps the numbers
+class QRemoteModelCompressor
+{
+public:
+    QRemoteModelCompressor();
+
+    QByteArray deflate(const QByteArray &payload, int *flags, QRemoteModelZStream *stream = Q_NULLPTR);
+    QByteArray inflate(const QByteArray &payload, bool *ok, QRemoteModelZStream *stream = Q_NULLPTR);
+
+    QVariantMap statistics() const;
+
+    int threshold;
+    // 0 disables compression, -1 is the zlib default
+    int level;
+
+private:
+    qint64 framesSent;
+    qint64 framesCompressed;
+    qint64 bytesIn;
+    qint64 bytesOut;
+    qint64 deflateTime;
+    qint64 framesInflated;
+    qint64 inflateTime;
+};
+
+class QRemoteModelProtocol
+{
+public:
+    // Version1 is the QDataStream encoding with numeric ids that every
+    // connection starts with until hello; the releases before hello, which
+    // used QUuid ids, cannot talk to this one
+    enum Version { Version1 = 1, Version2 = 2, Version3 = 3, CurrentVersion = Version3 };
+
+    // larger frames are taken for a broken or hostile peer
+    enum { MaximumFrameSize = 64 * 1024 * 1024 };
+    // a broken frame leaves the stream unusable, the connection has to go
+    enum FrameStatus { NoFrame, FrameRead, BrokenFrame };
+
+    // bits in the first byte of the frame header, the length uses the rest
+    enum FrameFlag { BinaryFrame = 0x80, CompressedFrame = 0x40 };
+
+    enum Opcode {
+        InvalidOpcode = 0x00,
+
+        Hello,
+        Index,
+        Parent,
+        ColumnCount,
+        RowCount,
+        Data,
+        CanFetchMore,
+        Flags,
+        Buddy,
+        HeaderData,
+        HasChildren,
+        Submit,
+        FetchMore,
+        Sibling,
+        RoleNames,
+        Structure,
+        RangeData,
+        ItemData,
+        // catches up on the changes missed since a sequence number, Version3
+        Resume,
+        // frees the shared memory of an answer, expects none, Version3
+        Release,
+        // returns the channel of a model registered by name, Version3
+        Open,
+        // the regions and roles whose value changes a client wants, expects
+        // none, Version3
+        Subscribe,
+
+        DataChanged = 0x40,
+        HeaderDataChanged,
+        LayoutChanged,
+        LayoutAboutToBeChanged,
+        RowsAboutToBeInserted,
+        RowsInserted,
+        RowsAboutToBeMoved,
+        RowsMoved,
+        RowsAboutToBeRemoved,
+        RowsRemoved,
+        ColumnsAboutToBeInserted,
+        ColumnsInserted,
+        ColumnsAboutToBeMoved,
+        ColumnsMoved,
+        ColumnsAboutToBeRemoved,
+        ColumnsRemoved,
+        ModelAboutToBeReset,
+        ModelReset,
+        // a list of opcode and argument pairs applied in one go, Version3
+        Transaction,
+
+        // the name follows as a string
+        ExtensionOpcode = 0xff
+    };
+
+    static quint8 opcode(const QByteArray &name);
+    static QByteArray name(quint8 opcode);
+
+    static QByteArray encode(const QRemoteModelMessage &message, int version);
+    static QByteArray frame(const QByteArray &payload, int version, QRemoteModelCompressor *compressor = Q_NULLPTR, QRemoteModelZStream *stream = Q_NULLPTR);
+    static QByteArray frame(const QRemoteModelMessage &message, int version, QRemoteModelCompressor *compressor = Q_NULLPTR, QRemoteModelZStream *stream = Q_NULLPTR);
+    static FrameStatus readFrame(QIODevice *device, QRemoteModelMessage *message, QRemoteModelCompressor *compressor = Q_NULLPTR, QRemoteModelZStream *stream = Q_NULLPTR);
+    // a payload that did not come in a frame, such as one in shared memory
+    static bool decode(const QByteArray &data, int flags, QRemoteModelMessage *message);
+};
+
+#endif // QREMOTEMODELPROTOCOL_P_H
@@ -0,0 +1,129 @@
+/* Copyright (c) 2015 Tasuku Suzuki.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Tasuku Suzuki nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL TASUKU SUZUKI BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "qremotemodelrelay.h"
+#include "qremotemodelclient.h"
+#include "qremotemodelserver.h"
+
+class QRemoteModelRelay::Private : public QObject
+{
+    Q_OBJECT
+public:
+    Private(QRemoteModelRelay *parent);
+
+    void prefetch(const QModelIndex &parent, int first, int last);
+
+private slots:
+    void modelReset();
+    void rowsInserted(const QModelIndex &parent, int first, int last);
+    void rangeFetched(const QModelIndex &parent, int first, int last);
+
+public:
+    // rows asked for at once while filling the mirror
+    enum { PrefetchRows = 1024 };
+
+    QRemoteModelClient *client;
+    QRemoteModelServer *server;
+};
+
+// the mirror is filled completely and never evicted, so downstream
+// requests are answered without asking upstream again
+QRemoteModelRelay::Private::Private(QRemoteModelRelay *parent)
+    : QObject(parent)
+    , client(new QRemoteModelClient(this))
+    , server(new QRemoteModelServer(this))
+{
+    client->setLazy(false);
+    client->setCacheBudget(0);
+    server->setModel(client);
+    connect(client, SIGNAL(modelReset()), this, SLOT(modelReset()));
+    connect(client, SIGNAL(rowsInserted(QModelIndex,int,int)), this, SLOT(rowsInserted(QModelIndex,int,int)));
+    connect(client, SIGNAL(rangeFetched(QModelIndex,int,int)), this, SLOT(rangeFetched(QModelIndex,int,int)));
+}
+
+void QRemoteModelRelay::Private::prefetch(const QModelIndex &parent, int first, int last)
+{
+    QVector<int> roles = client->roleNames().keys().toVector();
+    if (roles.isEmpty())
+        roles.append(Qt::DisplayRole);
+    for (int row = first; row <= last; row += PrefetchRows)
+        client->fetchRange(parent, row, qMin<int>(last, row + PrefetchRows - 1), roles);
+}
+
+void QRemoteModelRelay::Private::modelReset()
+{
+    int rows = client->rowCount();
+    if (rows > 0)
+        prefetch(QModelIndex(), 0, rows - 1);
+}
+
+void QRemoteModelRelay::Private::rowsInserted(const QModelIndex &parent, int first, int last)
+{
+    prefetch(parent, first, last);
+}
+
+// children are fetched once the rows above them are known, below any
+// column; fetched children arrive as inserted rows
+void QRemoteModelRelay::Private::rangeFetched(const QModelIndex &parent, int first, int last)
+{
+    last = qMin(last, client->rowCount(parent) - 1);
+    int columns = client->columnCount(parent);
+    for (int row = first; row <= last; row++) {
+        for (int column = 0; column < columns; column++) {
+            QModelIndex index = client->index(row, column, parent);
+            if (!client->hasChildren(index))
+                continue;
+            if (client->canFetchMore(index))
+                client->fetchMore(index);
+            int rows = client->rowCount(index);
+            if (rows > 0)
+                prefetch(index, 0, rows - 1);
+        }
+    }
+}
+
+QRemoteModelRelay::QRemoteModelRelay(QObject *parent)
+    : QObject(parent)
+    , d(new Private(this))
+{
+}
+
+QRemoteModelRelay::~QRemoteModelRelay()
+{
+    delete d;
+}
+
+QRemoteModelClient *QRemoteModelRelay::upstream() const
+{
+    return d->client;
+}
+
+QRemoteModelServer *QRemoteModelRelay::downstream() const
+{
+    return d->server;
+}
+
+#include "qremotemodelrelay.moc"
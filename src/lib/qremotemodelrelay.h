@@ -0,0 +1,57 @@
+/* Copyright (c) 2015 Tasuku Suzuki.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Tasuku Suzuki nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL TASUKU SUZUKI BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef QREMOTEMODELRELAY_H
+#define QREMOTEMODELRELAY_H
+
+#include "qtremotemodel_global.h"
+#include <QtCore/QObject>
+
+class QRemoteModelClient;
+class QRemoteModelServer;
+
+// mirrors the model of an upstream server with a single client and serves
+// the mirror to its own clients, so the source only sees one connection;
+// relays can be chained
+class QTREMOTEMODEL_EXPORT QRemoteModelRelay : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(QRemoteModelClient *upstream READ upstream CONSTANT)
+    Q_PROPERTY(QRemoteModelServer *downstream READ downstream CONSTANT)
+public:
+    explicit QRemoteModelRelay(QObject *parent = 0);
+    ~QRemoteModelRelay();
+
+    // connect and configure these as usual; the server serves the client
+    QRemoteModelClient *upstream() const;
+    QRemoteModelServer *downstream() const;
+
+private:
+    class Private;
+    Private *d;
+};
+
+#endif // QREMOTEMODELRELAY_H
@@ -0,0 +1,454 @@
+/* Copyright (c) 2015 Tasuku Suzuki.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Tasuku Suzuki nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL TASUKU SUZUKI BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "qremotemodelrowindex_p.h"
+
+QRemoteModelRowIndex::QRemoteModelRowIndex()
+    : root(new Leaf)
+{
+}
+
+QRemoteModelRowIndex::~QRemoteModelRowIndex()
+{
+    deleteBlock(root);
+}
+
+QRemoteModelRowIndex::Item *QRemoteModelRowIndex::at(int position) const
+{
+    if (position < 0 || position >= count())
+        return Q_NULLPTR;
+    int offset;
+    Leaf *leaf = findLeaf(position, &offset);
+    return leaf->gap ? Q_NULLPTR : leaf->items.at(offset);
+}
+
+int QRemoteModelRowIndex::positionOf(const Item *item) const
+{
+    const Leaf *leaf = item->leaf;
+    if (!leaf)
+        return -1;
+    int ret = leaf->items.indexOf(const_cast<Item *>(item));
+    for (const Block *block = leaf; block->parent; block = block->parent) {
+        foreach (const Block *sibling, block->parent->children) {
+            if (sibling == block)
+                break;
+            ret += sibling->count;
+        }
+    }
+    return ret;
+}
+
+QVector<QRemoteModelRowIndex::Item *> QRemoteModelRowIndex::mid(int position, int count) const
+{
+    QVector<Item *> ret;
+    if (position < 0)
+        position = 0;
+    count = qMin(count, this->count() - position);
+    if (count <= 0)
+        return ret;
+    ret.reserve(count);
+    int offset;
+    Leaf *leaf = findLeaf(position, &offset);
+    while (leaf && ret.count() < count) {
+        int n = qMin(count - ret.count(), leaf->count - offset);
+        if (leaf->gap)
+            ret.insert(ret.count(), n, Q_NULLPTR);
+        else
+            ret += leaf->items.mid(offset, n);
+        offset = 0;
+        leaf = nextLeaf(leaf);
+    }
+    return ret;
+}
+
+QVector<QRemoteModelRowIndex::Item *> QRemoteModelRowIndex::items(int position, int count, QVector<int> *positions) const
+{
+    QVector<Item *> ret;
+    if (position < 0)
+        position = 0;
+    count = qMin(count, this->count() - position);
+    if (count <= 0)
+        return ret;
+    int offset;
+    Leaf *leaf = findLeaf(position, &offset);
+    int done = 0;
+    while (leaf && done < count) {
+        int n = qMin(count - done, leaf->count - offset);
+        if (!leaf->gap) {
+            for (int i = 0; i < n; i++) {
+                ret.append(leaf->items.at(offset + i));
+                if (positions)
+                    positions->append(position + done + i);
+            }
+        }
+        done += n;
+        offset = 0;
+        leaf = nextLeaf(leaf);
+    }
+    return ret;
+}
+
+void QRemoteModelRowIndex::insert(int position, Item *item)
+{
+    insert(position, QVector<Item *>() << item);
+}
+
+void QRemoteModelRowIndex::insert(int position, const QVector<Item *> &items)
+{
+    Q_ASSERT(position >= 0 && position <= count());
+    // at most MaxLeaf items at a time, so that one split is always enough
+    int done = 0;
+    while (done < items.count()) {
+        int offset;
+        Leaf *leaf = itemLeaf(position + done, &offset);
+        int n = qMin(items.count() - done, int(MaxLeaf));
+        leaf->items.insert(offset, n, Q_NULLPTR);
+        for (int i = 0; i < n; i++) {
+            Item *item = items.at(done + i);
+            Q_ASSERT(!item->leaf);
+            item->leaf = leaf;
+            leaf->items[offset + i] = item;
+        }
+        adjustCounts(leaf, n);
+        if (leaf->items.count() > MaxLeaf)
+            splitLeaf(leaf);
+        done += n;
+    }
+}
+
+void QRemoteModelRowIndex::insertVirtual(int position, int count)
+{
+    Q_ASSERT(position >= 0 && position <= this->count());
+    if (count <= 0)
+        return;
+    int offset;
+    Leaf *leaf = findLeaf(position, &offset);
+    if (!leaf->gap) {
+        if (leaf->items.isEmpty()) {
+            // the empty root
+            leaf->gap = true;
+        } else if (offset == 0) {
+            Leaf *previous = previousLeaf(leaf);
+            if (previous && previous->gap) {
+                leaf = previous;
+            } else {
+                splitLeafAt(leaf, 0);
+                leaf->gap = true;
+            }
+        } else {
+            if (offset < leaf->items.count())
+                splitLeafAt(leaf, offset);
+            Leaf *gap = new Leaf(true);
+            insertAfter(leaf, gap);
+            leaf = gap;
+        }
+    }
+    adjustCounts(leaf, count);
+    mergeLeaf(leaf);
+}
+
+QVector<QRemoteModelRowIndex::Item *> QRemoteModelRowIndex::take(int position, int count)
+{
+    QVector<Item *> ret;
+    count = qMin(count, this->count() - position);
+    if (position < 0 || count <= 0)
+        return ret;
+    while (count > 0) {
+        int offset;
+        Leaf *leaf = findLeaf(position, &offset);
+        int n = qMin(count, leaf->count - offset);
+        if (!leaf->gap) {
+            for (int i = 0; i < n; i++) {
+                Item *item = leaf->items.at(offset + i);
+                item->leaf = Q_NULLPTR;
+                ret.append(item);
+            }
+            leaf->items.remove(offset, n);
+        }
+        adjustCounts(leaf, -n);
+        count -= n;
+        if (leaf->count == 0)
+            removeBlock(leaf);
+        else if (leaf->gap || leaf->items.count() < MaxLeaf / 4)
+            mergeLeaf(leaf);
+    }
+    return ret;
+}
+
+QVector<QRemoteModelRowIndex::Item *> QRemoteModelRowIndex::evict(int position, int count)
+{
+    count = qMin(count, this->count() - position);
+    if (position < 0 || count <= 0)
+        return QVector<Item *>();
+    QVector<Item *> ret = take(position, count);
+    insertVirtual(position, count);
+    return ret;
+}
+
+bool QRemoteModelRowIndex::check() const
+{
+    return !root->parent && checkBlock(root);
+}
+
+// the leaf holding position, or the last leaf when position is count()
+QRemoteModelRowIndex::Leaf *QRemoteModelRowIndex::findLeaf(int position, int *offset) const
+{
+    Block *block = root;
+    while (!block->leaf) {
+        const Branch *branch = static_cast<const Branch *>(block);
+        int i = 0;
+        for (; i < branch->children.count() - 1; i++) {
+            int count = branch->children.at(i)->count;
+            if (position < count)
+                break;
+            position -= count;
+        }
+        block = branch->children.at(i);
+    }
+    *offset = position;
+    return static_cast<Leaf *>(block);
+}
+
+// the leaf into which items go at position, split off a gap when needed
+QRemoteModelRowIndex::Leaf *QRemoteModelRowIndex::itemLeaf(int position, int *offset)
+{
+    Leaf *leaf = findLeaf(position, offset);
+    if (!leaf->gap)
+        return leaf;
+    if (*offset == 0) {
+        Leaf *previous = previousLeaf(leaf);
+        if (previous && !previous->gap) {
+            *offset = previous->items.count();
+            return previous;
+        }
+    }
+    Leaf *rest = Q_NULLPTR;
+    if (*offset < leaf->count) {
+        rest = new Leaf(true);
+        rest->count = leaf->count - *offset;
+        leaf->count = *offset;
+        insertAfter(leaf, rest);
+    }
+    if (leaf->count == 0) {
+        // the whole gap follows now, so the leaf itself takes the items
+        leaf->gap = false;
+    } else {
+        Leaf *items = new Leaf;
+        insertAfter(leaf, items);
+        leaf = items;
+    }
+    *offset = 0;
+    return leaf;
+}
+
+QRemoteModelRowIndex::Leaf *QRemoteModelRowIndex::nextLeaf(const Block *block) const
+{
+    while (block->parent) {
+        const Branch *parent = block->parent;
+        int i = parent->children.indexOf(const_cast<Block *>(block));
+        if (i + 1 < parent->children.count()) {
+            Block *next = parent->children.at(i + 1);
+            while (!next->leaf)
+                next = static_cast<Branch *>(next)->children.first();
+            return static_cast<Leaf *>(next);
+        }
+        block = parent;
+    }
+    return Q_NULLPTR;
+}
+
+QRemoteModelRowIndex::Leaf *QRemoteModelRowIndex::previousLeaf(const Block *block) const
+{
+    while (block->parent) {
+        const Branch *parent = block->parent;
+        int i = parent->children.indexOf(const_cast<Block *>(block));
+        if (i > 0) {
+            Block *previous = parent->children.at(i - 1);
+            while (!previous->leaf)
+                previous = static_cast<Branch *>(previous)->children.last();
+            return static_cast<Leaf *>(previous);
+        }
+        block = parent;
+    }
+    return Q_NULLPTR;
+}
+
+void QRemoteModelRowIndex::adjustCounts(Block *block, int delta)
+{
+    for (; block; block = block->parent)
+        block->count += delta;
+}
+
+// sibling takes over part of the rows of block, the counts above stay
+void QRemoteModelRowIndex::insertAfter(Block *block, Block *sibling)
+{
+    Branch *parent = block->parent;
+    if (!parent) {
+        parent = new Branch;
+        parent->count = block->count + sibling->count;
+        parent->children.append(block);
+        block->parent = parent;
+        root = parent;
+    }
+    parent->children.insert(parent->children.indexOf(block) + 1, sibling);
+    sibling->parent = parent;
+    if (parent->children.count() > MaxBranch)
+        splitBranch(parent);
+}
+
+void QRemoteModelRowIndex::splitLeaf(Leaf *leaf)
+{
+    splitLeafAt(leaf, leaf->items.count() / 2);
+}
+
+// moves the items from offset on into a new leaf after leaf
+QRemoteModelRowIndex::Leaf *QRemoteModelRowIndex::splitLeafAt(Leaf *leaf, int offset)
+{
+    Leaf *next = new Leaf;
+    next->items = leaf->items.mid(offset);
+    leaf->items.resize(offset);
+    foreach (Item *item, next->items)
+        item->leaf = next;
+    next->count = next->items.count();
+    leaf->count = offset;
+    insertAfter(leaf, next);
+    return next;
+}
+
+void QRemoteModelRowIndex::splitBranch(Branch *branch)
+{
+    Branch *next = new Branch;
+    int half = branch->children.count() / 2;
+    next->children = branch->children.mid(half);
+    branch->children.resize(half);
+    foreach (Block *child, next->children) {
+        child->parent = next;
+        next->count += child->count;
+    }
+    branch->count -= next->count;
+    insertAfter(branch, next);
+}
+
+// folds a small leaf, or a gap, into a neighbour of the same kind below
+// the same branch
+void QRemoteModelRowIndex::mergeLeaf(Leaf *leaf)
+{
+    Branch *parent = leaf->parent;
+    if (!parent)
+        return;
+    int i = parent->children.indexOf(leaf);
+    Leaf *left = Q_NULLPTR;
+    Leaf *right = Q_NULLPTR;
+    for (int j = i + 1; j >= i - 1 && !right; j -= 2) {
+        if (j < 0 || j >= parent->children.count())
+            continue;
+        Leaf *sibling = static_cast<Leaf *>(parent->children.at(j));
+        if (sibling->gap != leaf->gap)
+            continue;
+        if (!leaf->gap && leaf->items.count() + sibling->items.count() > MaxLeaf)
+            continue;
+        left = j > i ? leaf : sibling;
+        right = j > i ? sibling : leaf;
+    }
+    if (!right)
+        return;
+    foreach (Item *item, right->items)
+        item->leaf = left;
+    left->items += right->items;
+    left->count += right->count;
+    parent->children.removeOne(right);
+    delete right;
+    collapseRoot();
+}
+
+// block is empty by now, so no count changes above it
+void QRemoteModelRowIndex::removeBlock(Block *block)
+{
+    Q_ASSERT(block->count == 0);
+    Branch *parent = block->parent;
+    if (!parent) {
+        collapseRoot();
+        return;
+    }
+    parent->children.removeOne(block);
+    deleteBlock(block);
+    if (parent->children.isEmpty())
+        removeBlock(parent);
+    else
+        collapseRoot();
+}
+
+void QRemoteModelRowIndex::collapseRoot()
+{
+    while (!root->leaf && static_cast<Branch *>(root)->children.count() == 1) {
+        Branch *branch = static_cast<Branch *>(root);
+        root = branch->children.first();
+        root->parent = Q_NULLPTR;
+        delete branch;
+    }
+    if (!root->leaf && static_cast<Branch *>(root)->children.isEmpty()) {
+        deleteBlock(root);
+        root = new Leaf;
+    } else if (root->leaf && root->count == 0) {
+        static_cast<Leaf *>(root)->gap = false;
+    }
+}
+
+void QRemoteModelRowIndex::deleteBlock(Block *block)
+{
+    if (block->leaf) {
+        delete static_cast<Leaf *>(block);
+    } else {
+        Branch *branch = static_cast<Branch *>(block);
+        foreach (Block *child, branch->children)
+            deleteBlock(child);
+        delete branch;
+    }
+}
+
+bool QRemoteModelRowIndex::checkBlock(const Block *block) const
+{
+    if (block->leaf) {
+        const Leaf *leaf = static_cast<const Leaf *>(block);
+        if (leaf->gap)
+            return leaf->items.isEmpty() && leaf->count > 0;
+        if (leaf->count != leaf->items.count() || (leaf->parent && leaf->items.isEmpty()))
+            return false;
+        foreach (const Item *item, leaf->items) {
+            if (item->leaf != leaf)
+                return false;
+        }
+        return true;
+    }
+    const Branch *branch = static_cast<const Branch *>(block);
+    int count = 0;
+    foreach (const Block *child, branch->children) {
+        if (child->parent != branch || !checkBlock(child))
+            return false;
+        count += child->count;
+    }
+    return count == branch->count;
+}
@@ -0,0 +1,137 @@
+/* Copyright (c) 2015 Tasuku Suzuki.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Tasuku Suzuki nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL TASUKU SUZUKI BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef QREMOTEMODELROWINDEX_P_H
+#define QREMOTEMODELROWINDEX_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QtRemoteModel API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include <QtCore/QVector>
+
+// An ordered sequence of rows kept in a counted B+ tree: leaves hold up
+// to MaxLeaf rows, branches up to MaxBranch blocks and every block knows
+// how many rows are below it. Positional lookup, insertion, removal and
+// the position of a given row are O(log n), the count is O(1).
+//
+// Rows can also be virtual: they are counted, but have no item. A run of
+// virtual rows of any length is a single gap leaf.
+class QRemoteModelRowIndex
+{
+public:
+    class Item;
+
+private:
+    struct Branch;
+
+    struct Block
+    {
+        explicit Block(bool leaf) : parent(Q_NULLPTR), count(0), leaf(leaf) {}
+        Branch *parent;
+        int count;
+        bool leaf;
+    };
+
+    struct Leaf : public Block
+    {
+        explicit Leaf(bool gap = false) : Block(true), gap(gap) {}
+        QVector<Item *> items;
+        // a gap holds count virtual rows and no items
+        bool gap;
+    };
+
+    struct Branch : public Block
+    {
+        Branch() : Block(false) {}
+        QVector<Block *> children;
+    };
+
+public:
+    // base of the row records; an item is in at most one index at a time
+    class Item
+    {
+    public:
+        Item() : leaf(Q_NULLPTR) {}
+
+    private:
+        friend class QRemoteModelRowIndex;
+        Leaf *leaf;
+    };
+
+    QRemoteModelRowIndex();
+    ~QRemoteModelRowIndex();
+
+    int count() const { return root->count; }
+    bool isEmpty() const { return root->count == 0; }
+
+    // null for virtual rows
+    Item *at(int position) const;
+    int positionOf(const Item *item) const;
+    QVector<Item *> mid(int position, int count) const;
+    // only the rows which have an item, and optionally their positions
+    QVector<Item *> items(int position, int count, QVector<int> *positions = Q_NULLPTR) const;
+
+    void insert(int position, Item *item);
+    void insert(int position, const QVector<Item *> &items);
+    void insertVirtual(int position, int count);
+    // removes the rows and returns their items without deleting them
+    QVector<Item *> take(int position, int count);
+    // turns the rows into virtual ones and returns their items
+    QVector<Item *> evict(int position, int count);
+
+    bool check() const;
+
+private:
+    Q_DISABLE_COPY(QRemoteModelRowIndex)
+    enum { MaxLeaf = 64, MaxBranch = 32 };
+
+    Leaf *findLeaf(int position, int *offset) const;
+    Leaf *itemLeaf(int position, int *offset);
+    Leaf *nextLeaf(const Block *block) const;
+    Leaf *previousLeaf(const Block *block) const;
+    void adjustCounts(Block *block, int delta);
+    void insertAfter(Block *block, Block *sibling);
+    void splitLeaf(Leaf *leaf);
+    Leaf *splitLeafAt(Leaf *leaf, int offset);
+    void splitBranch(Branch *branch);
+    void mergeLeaf(Leaf *leaf);
+    void removeBlock(Block *block);
+    void collapseRoot();
+    void deleteBlock(Block *block);
+    bool checkBlock(const Block *block) const;
+
+    Block *root;
+};
+
+#endif // QREMOTEMODELROWINDEX_P_H
@@ -25,24 +25,300 @@
  */
 
 #include "qremotemodelserver.h"
+#include "qremotemodelprotocol_p.h"
 
 #include <QtCore/QAbstractItemModel>
-#include <QtCore/QUuid>
-
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDateTime>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QPoint>
+#include <QtCore/QSet>
+#include <QtCore/QSharedMemory>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QThread>
+#include <QtCore/QTimer>
+#include <QtCore/QTimerEvent>
+
+#include <QtNetwork/QLocalServer>
+#include <QtNetwork/QLocalSocket>
 #include <QtNetwork/QTcpServer>
 #include <QtNetwork/QTcpSocket>
 
+class Worker;
+
+// a call read by a worker, to be answered on the model's thread
+struct Request
+{
+    Worker *worker;
+    quint32 connection;
+    // the client is on this host, large answers need no chunks
+    bool local;
+    QRemoteModelMessage message;
+};
+
+// the frames of one broadcast, encoded and compressed at most once per
+// protocol version by whichever worker needs that version first; all
+// connections without a streaming context of their own send the same buffer
+class SharedFrames
+{
+public:
+    explicit SharedFrames(const QRemoteModelMessage &message) : message(message) {}
+
+    QByteArray payload(int version);
+    QByteArray frame(int version, QRemoteModelCompressor *compressor);
+    QByteArray rawFrame(int version);
+
+    const QRemoteModelMessage message;
+    // the signals of a transaction one by one, for clients before Version3
+    QList<QSharedPointer<SharedFrames> > parts;
+
+private:
+    Q_DISABLE_COPY(SharedFrames)
+    QMutex mutex;
+    QByteArray payloads[QRemoteModelProtocol::CurrentVersion + 1];
+    QByteArray frames[QRemoteModelProtocol::CurrentVersion + 1];
+    QByteArray rawFrames[QRemoteModelProtocol::CurrentVersion + 1];
+};
+
+QByteArray SharedFrames::payload(int version)
+{
+    QMutexLocker locker(&mutex);
+    if (payloads[version].isEmpty())
+        payloads[version] = QRemoteModelProtocol::encode(message, version);
+    return payloads[version];
+}
+
+QByteArray SharedFrames::frame(int version, QRemoteModelCompressor *compressor)
+{
+    QByteArray payload = this->payload(version);
+    QMutexLocker locker(&mutex);
+    if (frames[version].isEmpty())
+        frames[version] = QRemoteModelProtocol::frame(payload, version, compressor);
+    return frames[version];
+}
+
+// uncompressed, for the clients on this host
+QByteArray SharedFrames::rawFrame(int version)
+{
+    QByteArray payload = this->payload(version);
+    QMutexLocker locker(&mutex);
+    if (rawFrames[version].isEmpty())
+        rawFrames[version] = QRemoteModelProtocol::frame(payload, version);
+    return rawFrames[version];
+}
+
+// a message to be encoded by a worker for one connection, or a broadcast
+// to all of them
+struct Outgoing
+{
+    quint32 connection;
+    QRemoteModelMessage message;
+    // the message encoded once queued, so that its size counts
+    QByteArray payload;
+    QSharedPointer<SharedFrames> broadcast;
+};
+
+// rows first to last below parent, given as points from the root, and
+// everything below them; last is -1 for all rows
+struct Region
+{
+    QVariantList parent;
+    int first;
+    int last;
+};
+
+// what a client watches of one model; value changes elsewhere are not sent
+struct Subscription
+{
+    Subscription() : seen(0) {}
+
+    QList<Region> regions;
+    // the roles whose values are pushed, empty for all
+    QSet<int> roles;
+    // the last change the client had applied when it subscribed; the
+    // regions only hold from the last change of structure on
+    quint32 seen;
+};
+
+class Connection
+{
+public:
+    Connection(quint32 id, QIODevice *socket, bool local)
+        : id(id), socket(socket), local(local), version(QRemoteModelProtocol::Version1), stream(Q_NULLPTR), resync(false)
+        , updateInterval(0), updateTimer(0), sequence(0), resuming(false), resumeId(0)
+        , queuedBytes(0), sharedBytes(0), requests(0), stalled(false) {}
+    ~Connection() { delete stream; qDeleteAll(segments); }
+
+    quint32 id;
+    // a QTcpSocket, or a QLocalSocket when local
+    QIODevice *socket;
+    bool local;
+    // clients stay on version 1 until they say hello
+    int version;
+    // deflate context when the client asked for streaming compression
+    QRemoteModelZStream *stream;
+    // messages not handed to the socket yet, only encoded once they are
+    QList<Outgoing> queue;
+    // the client fell too far behind and starts over once it caught up
+    bool resync;
+    // msecs between two updates of the same cells the client asked for;
+    // while the timer runs only the latest dataChanged of a range is kept
+    int updateInterval;
+    int updateTimer;
+    // in the order held, a replaced update leaves an empty entry behind;
+    // heldCells has the position of the latest one for each range
+    QList<Outgoing> held;
+    QHash<QByteArray, int> heldCells;
+    // the last change queued for the client
+    quint32 sequence;
+    // between a hello that announced a resume and its answer, the changes
+    // the client did not miss wait here
+    bool resuming;
+    quint32 resumeId;
+    QList<Outgoing> paused;
+    // shared memory of the answers a local client did not release yet
+    QHash<QString, QSharedMemory *> segments;
+    // the models besides the default one the client opened
+    QSet<quint32> channels;
+    // by channel, and the last change of structure queued for each
+    QHash<quint32, Subscription> subscriptions;
+    QHash<quint32, quint32> structures;
+    // the payload bytes in queue and in shared memory, and the requests
+    // not answered yet; past the limits nothing is read from the client
+    // until it caught up
+    qint64 queuedBytes;
+    qint64 sharedBytes;
+    int requests;
+    bool stalled;
+
+private:
+    Q_DISABLE_COPY(Connection)
+};
+
+// owns a share of the client connections and does their socket I/O,
+// framing and compression, in an I/O thread of its own or on the
+// thread of the server
+class Worker : public QObject
+{
+    Q_OBJECT
+public:
+    typedef std::function<void(const QList<Request> &requests)> Dispatch;
+
+    // dispatch hands the calls read to the server, from the thread of the worker
+    explicit Worker(const Dispatch &dispatch);
+    ~Worker();
+
+    // called from the thread of the server
+    void addConnection(qintptr socketDescriptor, bool local);
+    void post(const QList<Outgoing> &messages);
+    void configure(int threshold, int level, bool streamingCompression, quint32 epoch, const QHash<QString, quint32> &channels);
+    QVariantMap statistics();
+
+protected:
+    void timerEvent(QTimerEvent *event);
+
+private slots:
+    void processInbox();
+    void readData();
+    void bytesWritten();
+    void disconnected();
+
+private:
+    void read(Connection *connection);
+    bool saturated(Connection *connection) const;
+    void unstall(Connection *connection);
+
+private:
+    // the socket buffer is refilled from the queue below LowWatermark up
+    // to HighWatermark bytes; queued signals are conflated from
+    // ConflateLimit bytes on, and dropped for a reset at ResyncLimit.
+    // Answers are never dropped, instead the client is not read from while
+    // its answers exceed ResyncLimit or MaximumRequests are in flight
+    enum { LowWatermark = 256 * 1024, HighWatermark = 1024 * 1024, ConflateLimit = 1024 * 1024, ResyncLimit = 8 * 1024 * 1024 };
+    enum { MaximumRequests = 64 };
+    // answers to local clients from this size on go through shared memory
+    enum { SharedMemoryThreshold = 64 * 1024 };
+
+    void hello(Connection *connection, const QRemoteModelMessage &message);
+    void open(Connection *connection, const QRemoteModelMessage &message);
+    void subscribe(Connection *connection, const QRemoteModelMessage &message);
+    bool filter(Connection *connection, Outgoing *outgoing);
+    void queue(Connection *connection, const Outgoing &outgoing);
+    void hold(Connection *connection, const Outgoing &outgoing);
+    void resumed(Connection *connection, const Outgoing &reply);
+    void append(Connection *connection, const Outgoing &outgoing);
+    void release(Connection *connection);
+    void compactHeld(Connection *connection);
+    void conflate(Connection *connection, const QRemoteModelMessage &message);
+    void flush(Connection *connection);
+    void send(Connection *connection, const QByteArray &frame);
+    void share(Connection *connection, quint32 id, const QByteArray &payload);
+
+    Dispatch dispatch;
+
+    QMutex inboxMutex;
+    QList<QPair<qintptr, bool> > descriptors;
+    QList<Outgoing> inbox;
+    bool scheduled;
+
+    // guards the compressor, whose settings and statistics are used by the server
+    QMutex compressorMutex;
+    QRemoteModelCompressor compressor;
+    bool streamingCompression;
+    quint32 epoch;
+    // the named models and their channels
+    QHash<QString, quint32> channels;
+
+    // the last change of the default model handed to this worker
+    quint32 sequence;
+    quint32 nextConnection;
+    quint32 nextSegment;
+    QHash<quint32, Connection *> connections;
+    QHash<QIODevice *, Connection *> sockets;
+    QHash<int, Connection *> timers;
+};
+
+// hands the clients on this host to the same workers as the TCP ones
+class LocalServer : public QLocalServer
+{
+public:
+    typedef std::function<void(quintptr socketDescriptor)> Accept;
+
+    LocalServer(const Accept &accept, QObject *parent) : QLocalServer(parent), accept(accept) {}
+
+protected:
+    virtual void incomingConnection(quintptr socketDescriptor) { accept(socketDescriptor); }
+
+private:
+    Accept accept;
+};
+
 class QRemoteModelServer::Private : public QTcpServer
 {
     Q_OBJECT
 public:
-    Private(QRemoteModelServer *parent);
+    // a named model is served by a Private of its own, which shares the
+    // connections, workers and settings of its host
+    Private(QRemoteModelServer *parent, Private *host = Q_NULLPTR);
     ~Private();
 
     void connectModel();
     void disconnectModel();
+    void setModel(QAbstractItemModel *model);
+    void registerModel(const QString &name, QAbstractItemModel *model);
+
+    void startWorkers();
+    void stopWorkers();
+    void configureWorkers();
+    // called by the workers from their threads
+    void enqueue(const QList<Request> &requests);
+    void addConnection(qintptr socketDescriptor, bool local);
+    bool listenLocal(const QString &name);
 
 private:
+    typedef QVariant (Private::*Handler)(const QVariantList &args);
+
     QVariant index(const QVariantList &args);
     QVariant parent(const QVariantList &args);
     QVariant columnCount(const QVariantList &args);
@@ -57,10 +333,24 @@ private:
     QVariant fetchMore(const QVariantList &args);
     QVariant sibling(const QVariantList &args);
     QVariant roleNames(const QVariantList &args);
+    QVariant structure(const QVariantList &args);
+    QVariant rangeData(const QVariantList &args);
+    QVariant itemData(const QVariantList &args);
+    QVariant resume(const Request &request);
+    void handle(const Request &request);
+
+    QModelIndex resolve(const QVariant &path) const;
+    quint32 handle(const QModelIndex &index);
+
+    void writeShape(QDataStream &stream, const QModelIndex &parent, int depth);
+    void branches(const QModelIndex &parent, int first, int last, QVariantList *points, QVariantList *branchHandles);
+
+public slots:
+    void flushChanges();
 
 private slots:
-    void readData();
-    void disconnected();
+    void processRequests();
+    void releaseHandles();
 
     void modelDestroyed();
     void dataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight, const QVector<int> &roles);
@@ -83,109 +373,282 @@ private slots:
     void layoutChanged();
 
 private:
-    void methodReturn(QTcpSocket *socket, const QUuid &uuid, const QVariant &ret = QVariant());
+    void scheduleRelease();
+    void methodReturn(const Request &request, const QVariant &ret = QVariant());
+    void write(const Request &request, QtRemoteModel::CallType type, const QVariant &ret);
+    void flushReplies();
     void broadcast(const QByteArray &name, const QVariantList &args = QVariantList());
+    void post(const QSharedPointer<SharedFrames> &broadcast);
+    void journalize(const QSharedPointer<SharedFrames> &change);
+    bool mergeDataChanged(QRemoteModelMessage *pending, const QRemoteModelMessage &message) const;
+    bool mergeRows(const QRemoteModelMessage &message);
+    quint32 nextSequence();
 
 protected:
     virtual void incomingConnection(qintptr socketDescriptor);
 
 private:
     QRemoteModelServer *q;
+    // built-in methods indexed by opcode
+    QVector<Handler> handlers;
 
 public:
+    Private *host;
+    quint32 channel;
+    QHash<QString, Private *> models;
+    QHash<quint32, Private *> channels;
+    quint32 nextChannel;
+
     QAbstractItemModel *model;
-    QList<QTcpSocket *> clients;
+    // branches handed out to the clients, which refer to them by handle
+    // so that resolving an index does not depend on its depth
+    QHash<quint32, QPersistentModelIndex> handles;
+    // an index keeps the handle it got first
+    QHash<QPersistentModelIndex, quint32> handleIds;
+    quint32 nextHandle;
+    // set by resolve() for an unknown or released handle, or a point off
+    // the model; the request is answered with an error then
+    mutable bool unresolved;
+    bool releaseScheduled;
+    bool pushValues;
+    QHash<QByteArray, QRemoteModelServer::Method> methods;
+    // settings handed to the workers, which compress with their own copy
+    QRemoteModelCompressor compressor;
+    bool streamingCompression;
+    LocalServer *localServer;
+
+    int ioThreads;
+    QList<Worker *> workers;
+    QList<QThread *> threads;
+    int nextWorker;
+    // calls read by the workers, answered in batches on this thread
+    QMutex requestMutex;
+    QList<Request> requests;
+    bool processScheduled;
+    // answers go to the workers once a batch is done, or before the
+    // next signal so that they keep their order
+    QHash<Worker *, QList<Outgoing> > replies;
+    // signals held back for coalescing; -1 sends each one right away, 0
+    // holds them until control returns to the event loop
+    int coalescingLatency;
+    QList<QRemoteModelMessage> changes;
+    bool changesScheduled;
+    QTimer changeTimer;
+
+    // a client resumes only with the server instance and model it left
+    quint32 epoch;
+    // every change is numbered; the last journalSize of those sent are
+    // kept for clients that come back
+    quint32 sequence;
+    quint32 sentSequence;
+    int journalSize;
+    QList<QSharedPointer<SharedFrames> > journal;
 };
 
-QRemoteModelServer::Private::Private(QRemoteModelServer *parent)
-    : QTcpServer(parent)
+QRemoteModelServer::Private::Private(QRemoteModelServer *parent, Private *host)
+    : QTcpServer(host ? static_cast<QObject *>(host) : parent)
     , q(parent)
+    , host(host ? host : this)
+    , channel(0)
+    , nextChannel(0)
     , model(Q_NULLPTR)
+    , nextHandle(0)
+    , unresolved(false)
+    , releaseScheduled(false)
+    , pushValues(false)
+    , streamingCompression(false)
+    , localServer(Q_NULLPTR)
+    , ioThreads(0)
+    , nextWorker(0)
+    , processScheduled(false)
+    , coalescingLatency(-1)
+    , changesScheduled(false)
+    , epoch(quint32(QDateTime::currentMSecsSinceEpoch()) | 1)
+    , sequence(0)
+    , sentSequence(0)
+    , journalSize(1024)
 {
+    changeTimer.setSingleShot(true);
+    connect(&changeTimer, SIGNAL(timeout()), this, SLOT(flushChanges()));
+
+    // hello is answered by the workers themselves
+    handlers.fill(Q_NULLPTR, QRemoteModelProtocol::ExtensionOpcode + 1);
+    handlers[QRemoteModelProtocol::Index] = &Private::index;
+    handlers[QRemoteModelProtocol::Parent] = &Private::parent;
+    handlers[QRemoteModelProtocol::ColumnCount] = &Private::columnCount;
+    handlers[QRemoteModelProtocol::RowCount] = &Private::rowCount;
+    handlers[QRemoteModelProtocol::Data] = &Private::data;
+    handlers[QRemoteModelProtocol::CanFetchMore] = &Private::canFetchMore;
+    handlers[QRemoteModelProtocol::Flags] = &Private::flags;
+    handlers[QRemoteModelProtocol::Buddy] = &Private::buddy;
+    handlers[QRemoteModelProtocol::HeaderData] = &Private::headerData;
+    handlers[QRemoteModelProtocol::HasChildren] = &Private::hasChildren;
+    handlers[QRemoteModelProtocol::Submit] = &Private::submit;
+    handlers[QRemoteModelProtocol::FetchMore] = &Private::fetchMore;
+    handlers[QRemoteModelProtocol::Sibling] = &Private::sibling;
+    handlers[QRemoteModelProtocol::RoleNames] = &Private::roleNames;
+    handlers[QRemoteModelProtocol::Structure] = &Private::structure;
+    handlers[QRemoteModelProtocol::RangeData] = &Private::rangeData;
+    handlers[QRemoteModelProtocol::ItemData] = &Private::itemData;
 }
 
 QRemoteModelServer::Private::~Private()
 {
+    stopWorkers();
+}
+
+// ioThreads 0 keeps a single worker on this thread
+void QRemoteModelServer::Private::startWorkers()
+{
+    if (!workers.isEmpty())
+        return;
+    for (int i = 0; i < qMax(1, ioThreads); i++) {
+        Worker *worker = new Worker([this](const QList<Request> &requests) { enqueue(requests); });
+        if (ioThreads > 0) {
+            QThread *thread = new QThread(this);
+            worker->moveToThread(thread);
+            connect(thread, SIGNAL(finished()), worker, SLOT(deleteLater()));
+            thread->start();
+            threads.append(thread);
+        } else {
+            worker->setParent(this);
+        }
+        workers.append(worker);
+    }
+    configureWorkers();
+}
+
+void QRemoteModelServer::Private::stopWorkers()
+{
+    foreach (QThread *thread, threads) {
+        thread->quit();
+        thread->wait();
+    }
+    qDeleteAll(threads);
+    threads.clear();
+    workers.clear();
+}
+
+void QRemoteModelServer::Private::configureWorkers()
+{
+    QHash<QString, quint32> channels;
+    QHash<QString, Private *>::const_iterator i = models.constBegin();
+    for (; i != models.constEnd(); ++i)
+        channels.insert(i.key(), i.value()->channel);
+    foreach (Worker *worker, workers)
+        worker->configure(compressor.threshold, compressor.level, streamingCompression, epoch, channels);
+}
+
+// clients holding the old model start over
+void QRemoteModelServer::Private::setModel(QAbstractItemModel *model)
+{
+    bool reset = this->model;
+    disconnectModel();
+    handles.clear();
+    handleIds.clear();
+    this->model = model;
+    connectModel();
+    // nobody resumes across models
+    if (++epoch == 0)
+        ++epoch;
+    journal.clear();
+    if (reset)
+        broadcast("modelReset");
+}
+
+void QRemoteModelServer::Private::registerModel(const QString &name, QAbstractItemModel *model)
+{
+    Private *named = models.value(name);
+    if (!named) {
+        if (!model)
+            return;
+        named = new Private(q, this);
+        if (++nextChannel == 0)
+            ++nextChannel;
+        named->channel = nextChannel;
+        models.insert(name, named);
+        channels.insert(named->channel, named);
+        configureWorkers();
+    }
+    if (named->model != model)
+        named->setModel(model);
 }
 
 void QRemoteModelServer::Private::incomingConnection(qintptr socketDescriptor)
 {
-    QTcpSocket *client = new QTcpSocket(this);
-    client->setSocketDescriptor(socketDescriptor);
-    connect(client, SIGNAL(readyRead()), this, SLOT(readData()));
-    connect(client, SIGNAL(disconnected()), this, SLOT(disconnected()));
-    clients.append(client);
-}
-
-void QRemoteModelServer::Private::readData()
-{
-    QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
-    while (socket->bytesAvailable() > QtRemoteModel::HeaderLength) {
-        QByteArray header = socket->peek(QtRemoteModel::HeaderLength);
-        qint64 length = 0;
-        length |= header.at(0) << 24;
-        length |= header.at(1) << 16;
-        length |= header.at(2) <<  8;
-        length |= header.at(3);
-        if (socket->bytesAvailable() >= QtRemoteModel::HeaderLength + length) {
-            socket->read(QtRemoteModel::HeaderLength);
-            QDataStream stream(qUncompress(socket->read(length)));
-            QUuid uuid;
-            stream >> uuid;
-            int type;
-            stream >> type;
-            switch (type) {
-            case QtRemoteModel::MethodCall: {
-                QByteArray method;
-                stream >> method;
-                QVariantList args;
-                stream >> args;
-                qDebug() << length << uuid << type << method << args;
-                if (method == QByteArrayLiteral("index")) {
-                    methodReturn(socket, uuid, index(args));
-                } else if (method == QByteArrayLiteral("parent")) {
-                    methodReturn(socket, uuid, parent(args));
-                } else if (method == QByteArrayLiteral("columnCount")) {
-                    methodReturn(socket, uuid, columnCount(args));
-                } else if (method == QByteArrayLiteral("rowCount")) {
-                    methodReturn(socket, uuid, rowCount(args));
-                } else if (method == QByteArrayLiteral("data")) {
-                    methodReturn(socket, uuid, data(args));
-                } else if (method == QByteArrayLiteral("canFetchMore")) {
-                    methodReturn(socket, uuid, canFetchMore(args));
-                } else if (method == QByteArrayLiteral("flags")) {
-                    methodReturn(socket, uuid, flags(args));
-                } else if (method == QByteArrayLiteral("buddy")) {
-                    methodReturn(socket, uuid, buddy(args));
-                } else if (method == QByteArrayLiteral("headerData")) {
-                    methodReturn(socket, uuid, headerData(args));
-                } else if (method == QByteArrayLiteral("hasChildren")) {
-                    methodReturn(socket, uuid, hasChildren(args));
-                } else if (method == QByteArrayLiteral("submit")) {
-                    methodReturn(socket, uuid, submit(args));
-                } else if (method == QByteArrayLiteral("fetchMore")) {
-                    methodReturn(socket, uuid, fetchMore(args));
-                } else if (method == QByteArrayLiteral("sibling")) {
-                    methodReturn(socket, uuid, sibling(args));
-                } else if (method == QByteArrayLiteral("roleNames")) {
-                    methodReturn(socket, uuid, roleNames(args));
-                } else {
-                    Q_UNREACHABLE();
-                }
-                break; }
-            default:
-                qWarning() << type;
-                Q_UNREACHABLE();
-            }
+    addConnection(socketDescriptor, false);
+}
+
+void QRemoteModelServer::Private::addConnection(qintptr socketDescriptor, bool local)
+{
+    startWorkers();
+    workers.at(nextWorker++ % workers.count())->addConnection(socketDescriptor, local);
+}
+
+bool QRemoteModelServer::Private::listenLocal(const QString &name)
+{
+    if (!localServer)
+        localServer = new LocalServer([this](quintptr socketDescriptor) { addConnection(socketDescriptor, true); }, this);
+    if (!localServer->listen(name)) {
+        qCWarning(lcRemoteModel) << localServer->errorString();
+        return false;
+    }
+    return true;
+}
+
+void QRemoteModelServer::Private::enqueue(const QList<Request> &requests)
+{
+    QMutexLocker locker(&requestMutex);
+    this->requests += requests;
+    if (processScheduled)
+        return;
+    processScheduled = true;
+    QMetaObject::invokeMethod(this, "processRequests", Qt::QueuedConnection);
+}
+
+void QRemoteModelServer::Private::processRequests()
+{
+    QList<Request> batch;
+    {
+        QMutexLocker locker(&requestMutex);
+        batch.swap(requests);
+        processScheduled = false;
+    }
+    foreach (const Request &request, batch) {
+        Private *target = request.message.channel ? channels.value(request.message.channel) : this;
+        if (target) {
+            target->handle(request);
+        } else {
+            qCWarning(lcRemoteModel) << "unknown channel" << request.message.channel;
+            write(request, QtRemoteModel::ErrorReturn, QString::fromLatin1("unknown channel %1").arg(request.message.channel));
         }
     }
+    flushReplies();
 }
 
-void QRemoteModelServer::Private::disconnected()
+void QRemoteModelServer::Private::handle(const Request &request)
 {
-    QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
-    clients.removeOne(socket);
-    socket->deleteLater();
+    // an answer must not overtake the changes it already reflects
+    if (!changes.isEmpty())
+        flushChanges();
+    const QRemoteModelMessage &message = request.message;
+    qCDebug(lcRemoteModel) << message.channel << message.id << message.name << message.args;
+    Handler handler = handlers.at(message.opcode);
+    if (message.opcode == QRemoteModelProtocol::Resume) {
+        methodReturn(request, resume(request));
+    } else if (handler) {
+        unresolved = false;
+        QVariant ret = (this->*handler)(message.args);
+        if (unresolved)
+            write(request, QtRemoteModel::ErrorReturn, QStringLiteral("unknown handle or index"));
+        else
+            methodReturn(request, ret);
+    } else if (message.opcode == QRemoteModelProtocol::ExtensionOpcode && host->methods.contains(message.name)) {
+        methodReturn(request, host->methods.value(message.name)(message.args));
+    } else {
+        qCWarning(lcRemoteModel) << "unknown method" << message.name;
+        write(request, QtRemoteModel::ErrorReturn, QString::fromLatin1("unknown method %1").arg(QString::fromLatin1(message.name)));
+    }
 }
 
 void QRemoteModelServer::Private::connectModel()
@@ -264,6 +727,89 @@ void QRemoteModelServer::Private::disconnectModel()
     disconnect(model, SIGNAL(layoutChanged()), this, SLOT(layoutChanged()));
 }
 
+// the changes after the client's sequence number go to it alone, ahead of
+// the answer; otherwise it has to fetch the model again and continues from
+// the number returned
+QVariant QRemoteModelServer::Private::resume(const Request &request)
+{
+    const QVariantList &args = request.message.args;
+    int i = 0;
+    quint32 clientEpoch = args.value(i++).toUInt();
+    quint32 clientSequence = args.value(i++).toUInt();
+    QVariantList failed = QVariantList() << false << sentSequence;
+    if (clientEpoch != epoch || clientSequence > sentSequence)
+        return failed;
+    if (clientSequence < sentSequence && (journal.isEmpty() || journal.first()->message.id > clientSequence + 1))
+        return failed;
+    foreach (const QSharedPointer<SharedFrames> &change, journal) {
+        if (change->message.id <= clientSequence)
+            continue;
+        Outgoing outgoing;
+        outgoing.connection = request.connection;
+        outgoing.broadcast = change;
+        host->replies[request.worker].append(outgoing);
+    }
+    return QVariantList() << true << sentSequence;
+}
+
+// a path starts either at the root or at a handle, followed by the
+// (column, row) of each level below; an invalid index, which is the
+// root, is only returned for an empty path, anything else that leads
+// nowhere sets unresolved
+QModelIndex QRemoteModelServer::Private::resolve(const QVariant &path) const
+{
+    QModelIndex ret;
+    foreach (const QVariant &value, path.toList()) {
+        if (value.type() == QVariant::UInt) {
+            ret = handles.value(value.toUInt());
+        } else {
+            QPoint point = value.toPoint();
+            ret = model->index(point.y(), point.x(), ret);
+        }
+        if (!ret.isValid()) {
+            unresolved = true;
+            break;
+        }
+    }
+    return ret;
+}
+
+quint32 QRemoteModelServer::Private::handle(const QModelIndex &index)
+{
+    QPersistentModelIndex persistent(index);
+    quint32 ret = handleIds.value(persistent);
+    if (ret)
+        return ret;
+    // 0 means no handle
+    if (++nextHandle == 0)
+        ++nextHandle;
+    handles.insert(nextHandle, persistent);
+    handleIds.insert(persistent, nextHandle);
+    return nextHandle;
+}
+
+// the handles of removed branches go away once a burst of removals is over
+void QRemoteModelServer::Private::scheduleRelease()
+{
+    if (releaseScheduled)
+        return;
+    releaseScheduled = true;
+    QMetaObject::invokeMethod(this, "releaseHandles", Qt::QueuedConnection);
+}
+
+void QRemoteModelServer::Private::releaseHandles()
+{
+    releaseScheduled = false;
+    QMutableHashIterator<quint32, QPersistentModelIndex> i(handles);
+    while (i.hasNext()) {
+        i.next();
+        if (!i.value().isValid()) {
+            handleIds.remove(i.value());
+            i.remove();
+        }
+    }
+}
+
 QVariant QRemoteModelServer::Private::index(const QVariantList &args)
 {
     QVariant ret;
@@ -271,7 +817,7 @@ QVariant QRemoteModelServer::Private::index(const QVariantList &args)
         int i = 0;
         int row = args.at(i++).toInt();
         int column = args.at(i++).toInt();
-        QModelIndex parent = QtRemoteModel::toModelIndex(model, args.at(i++));
+        QModelIndex parent = resolve(args.at(i++));
         QModelIndex index = model->index(row, column, parent);
         ret = QtRemoteModel::fromModelIndex(index);
     }
@@ -283,7 +829,7 @@ QVariant QRemoteModelServer::Private::parent(const QVariantList &args)
     QVariant ret;
     if (model) {
         int i = 0;
-        QModelIndex child = QtRemoteModel::toModelIndex(model, args.at(i++));
+        QModelIndex child = resolve(args.at(i++));
         QModelIndex parent = model->parent(child);
         ret = QtRemoteModel::fromModelIndex(parent);
     }
@@ -297,7 +843,7 @@ QVariant QRemoteModelServer::Private::columnCount(const QVariantList &args)
         int i = 0;
         QModelIndex parent;
         if (args.length() > i) {
-            parent = QtRemoteModel::toModelIndex(model, args.at(i++));
+            parent = resolve(args.at(i++));
         }
         ret = model->columnCount(parent);
     }
@@ -311,7 +857,7 @@ QVariant QRemoteModelServer::Private::rowCount(const QVariantList &args)
         int i = 0;
         QModelIndex parent;
         if (args.length() > i) {
-            parent = QtRemoteModel::toModelIndex(model, args.at(i++));
+            parent = resolve(args.at(i++));
         }
         ret = model->rowCount(parent);
     }
@@ -323,7 +869,7 @@ QVariant QRemoteModelServer::Private::data(const QVariantList &args)
     QVariant ret;
     if (model) {
         int i = 0;
-        QModelIndex index = QtRemoteModel::toModelIndex(model, args.at(i++));
+        QModelIndex index = resolve(args.at(i++));
         int role = args.at(i++).toInt();
         ret = model->data(index, role);
     }
@@ -335,7 +881,7 @@ QVariant QRemoteModelServer::Private::canFetchMore(const QVariantList &args)
     QVariant ret;
     if (model) {
         int i = 0;
-        QModelIndex parent = QtRemoteModel::toModelIndex(model, args.at(i++));
+        QModelIndex parent = resolve(args.at(i++));
         ret = model->canFetchMore(parent);
     }
     return ret;
@@ -346,7 +892,7 @@ QVariant QRemoteModelServer::Private::flags(const QVariantList &args)
     QVariant ret;
     if (model) {
         int i = 0;
-        QModelIndex index = QtRemoteModel::toModelIndex(model, args.at(i++));
+        QModelIndex index = resolve(args.at(i++));
         ret = static_cast<int>(model->flags(index));
     }
     return ret;
@@ -357,7 +903,7 @@ QVariant QRemoteModelServer::Private::buddy(const QVariantList &args)
     QVariant ret;
     if (model) {
         int i = 0;
-        QModelIndex index = QtRemoteModel::toModelIndex(model, args.at(i++));
+        QModelIndex index = resolve(args.at(i++));
         QModelIndex buddy = model->buddy(index);
         ret = QtRemoteModel::fromModelIndex(buddy);
     }
@@ -382,7 +928,7 @@ QVariant QRemoteModelServer::Private::hasChildren(const QVariantList &args)
     QVariant ret;
     if (model) {
         int i = 0;
-        QModelIndex parent = QtRemoteModel::toModelIndex(model, args.at(i++));
+        QModelIndex parent = resolve(args.at(i++));
         ret = model->hasChildren(parent);
     }
     return ret;
@@ -403,8 +949,11 @@ QVariant QRemoteModelServer::Private::fetchMore(const QVariantList &args)
     QVariant ret;
     if (model) {
         int i = 0;
-        QModelIndex parent = QtRemoteModel::toModelIndex(model, args.at(i++));
+        QModelIndex parent = resolve(args.at(i++));
+        if (unresolved)
+            return ret;
         model->fetchMore(parent);
+        ret = model->canFetchMore(parent);
     }
     return ret;
 }
@@ -416,7 +965,7 @@ QVariant QRemoteModelServer::Private::sibling(const QVariantList &args)
         int i = 0;
         int row = args.at(i++).toInt();
         int column = args.at(i++).toInt();
-        QModelIndex idx = QtRemoteModel::toModelIndex(model, args.at(i++));
+        QModelIndex idx = resolve(args.at(i++));
         QModelIndex sibling = model->sibling(row, column, idx);
         ret = QtRemoteModel::fromModelIndex(sibling);
     }
@@ -438,14 +987,150 @@ QVariant QRemoteModelServer::Private::roleNames(const QVariantList &args)
     }
     return ret;
 }
+
+QVariant QRemoteModelServer::Private::structure(const QVariantList &args)
+{
+    QVariant ret;
+    if (model) {
+        int i = 0;
+        QModelIndex parent;
+        if (args.length() > i) {
+            parent = resolve(args.at(i++));
+        }
+        int depth = -1;
+        if (args.length() > i) {
+            depth = args.at(i++).toInt();
+        }
+        QByteArray shape;
+        {
+            QDataStream stream(&shape, QIODevice::WriteOnly);
+            writeShape(stream, parent, depth);
+        }
+        ret = shape;
+    }
+    return ret;
+}
+
+// values of rows first to last below parent in all columns, as one list
+// of row values for each column and role, column by column
+QVariant QRemoteModelServer::Private::rangeData(const QVariantList &args)
+{
+    QVariant ret;
+    if (model) {
+        int i = 0;
+        QModelIndex parent = resolve(args.at(i++));
+        int first = args.at(i++).toInt();
+        int last = qMin(args.at(i++).toInt(), model->rowCount(parent) - 1);
+        QVector<int> roles;
+        foreach (const QVariant &role, args.at(i++).toList()) {
+            roles.append(role.toInt());
+        }
+        if (roles.isEmpty())
+            roles = model->roleNames().keys().toVector();
+        int columnCount = model->columnCount(parent);
+        QVariantList block;
+        for (int column = 0; column < columnCount; column++) {
+            foreach (int role, roles) {
+                QVariantList values;
+                for (int row = first; row <= last; row++) {
+                    values.append(model->data(model->index(row, column, parent), role));
+                }
+                block.append(QVariant(values));
+            }
+        }
+        ret = block;
+    }
+    return ret;
+}
+
+QVariant QRemoteModelServer::Private::itemData(const QVariantList &args)
+{
+    QVariant ret;
+    if (model) {
+        int i = 0;
+        QModelIndex index = resolve(args.at(i++));
+        QHash<QString, QVariant> hash;
+        QMapIterator<int, QVariant> j(model->itemData(index));
+        while (j.hasNext()) {
+            j.next();
+            hash.insert(QString::number(j.key()), j.value());
+        }
+        ret = hash;
+    }
+    return ret;
+}
+
+// rowCount, columnCount, canFetchMore and the number of cells with
+// children, followed by (row, column, handle, expanded) for each of them
+// and the shape of the expanded ones; a flat table costs 13 bytes. depth limits
+// how many levels are expanded, a negative depth expands everything.
+void QRemoteModelServer::Private::writeShape(QDataStream &stream, const QModelIndex &parent, int depth)
+{
+    int rowCount = model->rowCount(parent);
+    int columnCount = model->columnCount(parent);
+    QList<QModelIndex> branches;
+    for (int row = 0; row < rowCount; row++) {
+        for (int column = 0; column < columnCount; column++) {
+            QModelIndex index = model->index(row, column, parent);
+            if (model->hasChildren(index))
+                branches.append(index);
+        }
+    }
+    stream << static_cast<qint32>(rowCount) << static_cast<qint32>(columnCount);
+    stream << model->canFetchMore(parent);
+    stream << static_cast<qint32>(branches.count());
+    bool expanded = depth != 1;
+    foreach (const QModelIndex &index, branches) {
+        stream << static_cast<qint32>(index.row()) << static_cast<qint32>(index.column()) << handle(index) << expanded;
+        if (expanded)
+            writeShape(stream, index, depth < 0 ? depth : depth - 1);
+    }
+}
+
+// cells of the given rows which have children of their own
+void QRemoteModelServer::Private::branches(const QModelIndex &parent, int first, int last, QVariantList *points, QVariantList *branchHandles)
+{
+    int columnCount = model->columnCount(parent);
+    for (int row = first; row <= last; row++) {
+        for (int column = 0; column < columnCount; column++) {
+            QModelIndex index = model->index(row, column, parent);
+            if (model->hasChildren(index)) {
+                points->append(QPoint(column, row));
+                branchHandles->append(handle(index));
+            }
+        }
+    }
+}
+
 void QRemoteModelServer::Private::modelDestroyed()
 {
+    handles.clear();
+    handleIds.clear();
     model = nullptr;
 }
 
 void QRemoteModelServer::Private::dataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight, const QVector<int> &roles)
 {
-    broadcast("dataChanged", QVariantList() << QtRemoteModel::fromModelIndex(topLeft) << QtRemoteModel::fromModelIndex(bottomRight) << QtRemoteModel::toVariant(roles));
+    QVariantList args;
+    args << QtRemoteModel::fromModelIndex(topLeft) << QtRemoteModel::fromModelIndex(bottomRight) << QtRemoteModel::toVariant(roles);
+    if (host->pushValues) {
+        // the new values travel with the signal, row by row, column by
+        // column and role by role, so that clients need not ask for them
+        QVector<int> valueRoles = roles;
+        if (valueRoles.isEmpty())
+            valueRoles = model->roleNames().keys().toVector();
+        QModelIndex parent = topLeft.parent();
+        QVariantList values;
+        for (int row = topLeft.row(); row <= bottomRight.row(); row++) {
+            for (int column = topLeft.column(); column <= bottomRight.column(); column++) {
+                QModelIndex index = model->index(row, column, parent);
+                foreach (int role, valueRoles)
+                    values.append(model->data(index, role));
+            }
+        }
+        args << QVariant(values) << QtRemoteModel::toVariant(valueRoles);
+    }
+    broadcast("dataChanged", args);
 }
 
 void QRemoteModelServer::Private::headerDataChanged(Qt::Orientation orientation, int first, int last)
@@ -460,7 +1145,10 @@ void QRemoteModelServer::Private::rowsAboutToBeInserted(const QModelIndex &paren
 
 void QRemoteModelServer::Private::rowsInserted(const QModelIndex &parent, int first, int last)
 {
-    broadcast("rowsInserted", QVariantList() << QtRemoteModel::fromModelIndex(parent) << first << last);
+    QVariantList points;
+    QVariantList branchHandles;
+    branches(parent, first, last, &points, &branchHandles);
+    broadcast("rowsInserted", QVariantList() << QtRemoteModel::fromModelIndex(parent) << first << last << model->columnCount(parent) << QVariant(points) << QVariant(branchHandles));
 }
 
 void QRemoteModelServer::Private::rowsAboutToBeMoved(const QModelIndex &sourceParent, int sourceStart, int sourceEnd, const QModelIndex &destinationParent, int destinationRow)
@@ -481,6 +1169,7 @@ void QRemoteModelServer::Private::rowsAboutToBeRemoved(const QModelIndex &parent
 void QRemoteModelServer::Private::rowsRemoved(const QModelIndex &parent, int first, int last)
 {
     broadcast("rowsRemoved", QVariantList() << QtRemoteModel::fromModelIndex(parent) << first << last);
+    scheduleRelease();
 }
 
 void QRemoteModelServer::Private::columnsAboutToBeInserted(const QModelIndex &parent, int first, int last)
@@ -511,10 +1200,13 @@ void QRemoteModelServer::Private::columnsAboutToBeRemoved(const QModelIndex &par
 void QRemoteModelServer::Private::columnsRemoved(const QModelIndex &parent, int first, int last)
 {
     broadcast("columnsRemoved", QVariantList() << QtRemoteModel::fromModelIndex(parent) << first << last);
+    scheduleRelease();
 }
 
 void QRemoteModelServer::Private::modelReset()
 {
+    handles.clear();
+    handleIds.clear();
     broadcast("modelReset");
 }
 
@@ -523,58 +1215,899 @@ void QRemoteModelServer::Private::layoutChanged()
     broadcast("layoutChanged");
 }
 
-void QRemoteModelServer::Private::methodReturn(QTcpSocket *socket, const QUuid &uuid, const QVariant &ret)
+void QRemoteModelServer::Private::methodReturn(const Request &request, const QVariant &ret)
 {
-    QByteArray response;
-    {
-        QDataStream stream(&response, QIODevice::WriteOnly);
-        stream << uuid;
-        stream << QtRemoteModel::MethodReturn;
-        stream << ret;
-    }
-    response = qCompress(response);
-    int length = response.length();
-    qDebug() << length << uuid << ret;
-    QByteArray header(QtRemoteModel::HeaderLength, Qt::Uninitialized);
-    for (int i = 0; i < QtRemoteModel::HeaderLength; i++) {
-        header[0] = (length & 0xff000000) << 24;
-        header[1] = (length & 0x00ff0000) << 16;
-        header[2] = (length & 0x0000ff00) <<  8;
-        header[3] = (length & 0x000000ff);
-    }
-    if (socket->write(header) != header.length())
-        Q_UNREACHABLE();
-    if (socket->write(response) != response.length())
-        Q_UNREACHABLE();
+    // large binary answers such as structure snapshots go out in chunks
+    // which the client concatenates again, unless shared memory takes them
+    if (!request.local && ret.type() == QVariant::ByteArray && ret.toByteArray().length() > QtRemoteModel::ChunkSize) {
+        QByteArray data = ret.toByteArray();
+        int offset = 0;
+        for (; data.length() - offset > QtRemoteModel::ChunkSize; offset += QtRemoteModel::ChunkSize)
+            write(request, QtRemoteModel::PartialReturn, data.mid(offset, QtRemoteModel::ChunkSize));
+        write(request, QtRemoteModel::MethodReturn, data.mid(offset));
+    } else {
+        write(request, QtRemoteModel::MethodReturn, ret);
+    }
+}
+
+void QRemoteModelServer::Private::write(const Request &request, QtRemoteModel::CallType type, const QVariant &ret)
+{
+    Outgoing outgoing;
+    outgoing.connection = request.connection;
+    outgoing.message.type = type;
+    outgoing.message.id = request.message.id;
+    outgoing.message.value = ret;
+    host->replies[request.worker].append(outgoing);
+}
+
+void QRemoteModelServer::Private::flushReplies()
+{
+    if (host != this) {
+        host->flushReplies();
+        return;
+    }
+    QHash<Worker *, QList<Outgoing> >::const_iterator i = replies.constBegin();
+    for (; i != replies.constEnd(); ++i)
+        i.key()->post(i.value());
+    replies.clear();
 }
 
 void QRemoteModelServer::Private::broadcast(const QByteArray &signal, const QVariantList &args)
 {
-    QUuid uuid = QUuid::createUuid();
-    QByteArray data;
+    QRemoteModelMessage message;
+    message.type = QtRemoteModel::EmitSignal;
+    message.name = signal;
+    message.opcode = QRemoteModelProtocol::opcode(signal);
+    message.args = args;
+    message.channel = channel;
+    int coalescingLatency = host->coalescingLatency;
+    if (coalescingLatency < 0) {
+        message.id = nextSequence();
+        flushReplies();
+        QSharedPointer<SharedFrames> change = QSharedPointer<SharedFrames>::create(message);
+        journalize(change);
+        post(change);
+        return;
+    }
+
+    if (message.opcode == QRemoteModelProtocol::DataChanged && !changes.isEmpty() && mergeDataChanged(&changes.last(), message))
+        return;
+    if (!mergeRows(message))
+        changes.append(message);
+    if (changesScheduled)
+        return;
+    changesScheduled = true;
+    if (coalescingLatency > 0)
+        changeTimer.start(coalescingLatency);
+    else
+        QMetaObject::invokeMethod(this, "flushChanges", Qt::QueuedConnection);
+}
+
+// numbers are taken when the changes go out, so that those merged
+// leave no gap the journal would take for a lost change
+quint32 QRemoteModelServer::Private::nextSequence()
+{
+    if (++sequence == 0)
+        ++sequence;
+    return sequence;
+}
+
+// the workers encode it, this thread only hands out references
+void QRemoteModelServer::Private::post(const QSharedPointer<SharedFrames> &broadcast)
+{
+    Outgoing outgoing;
+    outgoing.connection = 0;
+    outgoing.broadcast = broadcast;
+    foreach (Worker *worker, host->workers)
+        worker->post(QList<Outgoing>() << outgoing);
+}
+
+void QRemoteModelServer::Private::journalize(const QSharedPointer<SharedFrames> &change)
+{
+    sentSequence = change->message.id;
+    if (host->journalSize <= 0)
+        return;
+    journal.append(change);
+    while (journal.count() > host->journalSize)
+        journal.removeFirst();
+}
+
+// the held changes go out as one transaction frame
+void QRemoteModelServer::Private::flushChanges()
+{
+    changesScheduled = false;
+    changeTimer.stop();
+    if (changes.isEmpty())
+        return;
+    flushReplies();
+    for (int i = 0; i < changes.count(); i++)
+        changes[i].id = nextSequence();
+    if (changes.count() == 1) {
+        QSharedPointer<SharedFrames> change = QSharedPointer<SharedFrames>::create(changes.takeFirst());
+        journalize(change);
+        post(change);
+        return;
+    }
+    // the transaction has the number of its last change and is journaled
+    // change by change
+    QRemoteModelMessage message;
+    message.type = QtRemoteModel::EmitSignal;
+    message.name = QByteArrayLiteral("transaction");
+    message.opcode = QRemoteModelProtocol::Transaction;
+    message.id = changes.last().id;
+    message.channel = channel;
+    QList<QSharedPointer<SharedFrames> > parts;
+    foreach (const QRemoteModelMessage &change, changes) {
+        message.args.append(QVariant(QVariantList() << change.opcode << QVariant(change.args)));
+        parts.append(QSharedPointer<SharedFrames>::create(change));
+        journalize(parts.last());
+    }
+    changes.clear();
+    QSharedPointer<SharedFrames> transaction = QSharedPointer<SharedFrames>::create(message);
+    transaction->parts = parts;
+    post(transaction);
+}
+
+static QVariantList parentPath(const QVariant &path)
+{
+    QVariantList ret = path.toList();
+    if (!ret.isEmpty())
+        ret.removeLast();
+    return ret;
+}
+
+// rows next to each other or overlapping in the same columns and roles
+// become one range; pushed values are only joined when the rows are adjacent
+bool QRemoteModelServer::Private::mergeDataChanged(QRemoteModelMessage *pending, const QRemoteModelMessage &message) const
+{
+    if (pending->opcode != QRemoteModelProtocol::DataChanged)
+        return false;
+    const QVariantList &a = pending->args;
+    const QVariantList &b = message.args;
+    if (a.count() != b.count() || a.at(2) != b.at(2) || (a.count() > 4 && a.at(4) != b.at(4)))
+        return false;
+    QVariantList parent = parentPath(a.at(0));
+    if (parentPath(a.at(1)) != parent || parentPath(b.at(0)) != parent || parentPath(b.at(1)) != parent)
+        return false;
+    QPoint topLeft = a.at(0).toList().value(parent.count()).toPoint();
+    QPoint bottomRight = a.at(1).toList().value(parent.count()).toPoint();
+    QPoint newTopLeft = b.at(0).toList().value(parent.count()).toPoint();
+    QPoint newBottomRight = b.at(1).toList().value(parent.count()).toPoint();
+    if (topLeft.x() != newTopLeft.x() || bottomRight.x() != newBottomRight.x())
+        return false;
+
+    bool values = a.count() > 3;
+    QVariantList args = a;
+    if (topLeft.y() == newTopLeft.y() && bottomRight.y() == newBottomRight.y()) {
+        args = b;
+    } else if (newTopLeft.y() == bottomRight.y() + 1) {
+        args[1] = b.at(1);
+        if (values)
+            args[3] = QVariant(a.at(3).toList() + b.at(3).toList());
+    } else if (newBottomRight.y() + 1 == topLeft.y()) {
+        args[0] = b.at(0);
+        if (values)
+            args[3] = QVariant(b.at(3).toList() + a.at(3).toList());
+    } else if (!values && newTopLeft.y() <= bottomRight.y() && newBottomRight.y() >= topLeft.y()) {
+        if (newTopLeft.y() < topLeft.y())
+            args[0] = b.at(0);
+        if (newBottomRight.y() > bottomRight.y())
+            args[1] = b.at(1);
+    } else {
+        return false;
+    }
+    pending->args = args;
+    return true;
+}
+
+// an insertion or removal touching the run of rows held right before it
+// joins that run, so that the client sees one begin and end pair; the
+// announcement of the new rows is the last change held at that point
+bool QRemoteModelServer::Private::mergeRows(const QRemoteModelMessage &message)
+{
+    bool insert = message.opcode == QRemoteModelProtocol::RowsInserted;
+    if (!insert && message.opcode != QRemoteModelProtocol::RowsRemoved)
+        return false;
+    int count = changes.count();
+    if (count < 3)
+        return false;
+    quint8 announcement = insert ? QRemoteModelProtocol::RowsAboutToBeInserted : QRemoteModelProtocol::RowsAboutToBeRemoved;
+    QRemoteModelMessage &runAnnouncement = changes[count - 3];
+    QRemoteModelMessage &run = changes[count - 2];
+    const QRemoteModelMessage &newAnnouncement = changes.at(count - 1);
+    if (runAnnouncement.opcode != announcement || run.opcode != message.opcode || newAnnouncement.opcode != announcement)
+        return false;
+    int i = 0;
+    QVariant parent = message.args.at(i++);
+    int first = message.args.at(i++).toInt();
+    int last = message.args.at(i++).toInt();
+    if (run.args.at(0) != parent || newAnnouncement.args.at(0) != parent)
+        return false;
+    int runFirst = run.args.at(1).toInt();
+    int runLast = run.args.at(2).toInt();
+
+    if (insert) {
+        // the new rows go into the run or right after it
+        if (first < runFirst || first > runLast + 1)
+            return false;
+        int added = last - first + 1;
+        QVariantList points;
+        foreach (const QVariant &value, run.args.value(4).toList()) {
+            QPoint point = value.toPoint();
+            if (point.y() >= first)
+                point.ry() += added;
+            points.append(point);
+        }
+        points += message.args.value(4).toList();
+        run.args[2] = runLast + added;
+        run.args[3] = message.args.value(3);
+        run.args[4] = QVariant(points);
+        run.args[5] = QVariant(run.args.value(5).toList() + message.args.value(5).toList());
+    } else {
+        // the rows removed now have to border on the hole the run left
+        if (first > runFirst || last < runFirst - 1)
+            return false;
+        run.args[1] = first;
+        run.args[2] = first + (runLast - runFirst + 1) + (last - first + 1) - 1;
+    }
+    runAnnouncement.args[1] = run.args.at(1);
+    runAnnouncement.args[2] = run.args.at(2);
+    changes.removeLast();
+    return true;
+}
+
+Worker::Worker(const Dispatch &dispatch)
+    : dispatch(dispatch)
+    , scheduled(false)
+    , streamingCompression(false)
+    , epoch(0)
+    , sequence(0)
+    , nextConnection(0)
+    , nextSegment(0)
+{
+}
+
+Worker::~Worker()
+{
+    qDeleteAll(connections);
+}
+
+void Worker::addConnection(qintptr socketDescriptor, bool local)
+{
+    QMutexLocker locker(&inboxMutex);
+    descriptors.append(qMakePair(socketDescriptor, local));
+    if (!scheduled) {
+        scheduled = true;
+        QMetaObject::invokeMethod(this, "processInbox", Qt::QueuedConnection);
+    }
+}
+
+void Worker::post(const QList<Outgoing> &messages)
+{
+    QMutexLocker locker(&inboxMutex);
+    inbox += messages;
+    if (!scheduled) {
+        scheduled = true;
+        QMetaObject::invokeMethod(this, "processInbox", Qt::QueuedConnection);
+    }
+}
+
+void Worker::configure(int threshold, int level, bool streamingCompression, quint32 epoch, const QHash<QString, quint32> &channels)
+{
+    QMutexLocker locker(&compressorMutex);
+    compressor.threshold = threshold;
+    compressor.level = level;
+    this->streamingCompression = streamingCompression;
+    this->epoch = epoch;
+    this->channels = channels;
+}
+
+QVariantMap Worker::statistics()
+{
+    QMutexLocker locker(&compressorMutex);
+    return compressor.statistics();
+}
+
+// everything posted since the last time goes out in one write per client
+void Worker::processInbox()
+{
+    QList<QPair<qintptr, bool> > newDescriptors;
+    QList<Outgoing> messages;
     {
-        QDataStream stream(&data, QIODevice::WriteOnly);
-        stream << uuid;
-        stream << QtRemoteModel::EmitSignal;
-        stream << signal;
-        stream << args;
+        QMutexLocker locker(&inboxMutex);
+        newDescriptors.swap(descriptors);
+        messages.swap(inbox);
+        scheduled = false;
+    }
+
+    for (int i = 0; i < newDescriptors.count(); i++) {
+        qintptr socketDescriptor = newDescriptors.at(i).first;
+        bool local = newDescriptors.at(i).second;
+        QIODevice *socket;
+        // a stalled client fills its socket, not this process
+        qint64 readBufferSize = QtRemoteModel::HeaderLength + QRemoteModelProtocol::MaximumFrameSize;
+        if (local) {
+            QLocalSocket *localSocket = new QLocalSocket(this);
+            localSocket->setSocketDescriptor(socketDescriptor);
+            localSocket->setReadBufferSize(readBufferSize);
+            socket = localSocket;
+        } else {
+            QTcpSocket *tcpSocket = new QTcpSocket(this);
+            tcpSocket->setSocketDescriptor(socketDescriptor);
+            tcpSocket->setReadBufferSize(readBufferSize);
+            socket = tcpSocket;
+        }
+        connect(socket, SIGNAL(readyRead()), this, SLOT(readData()));
+        connect(socket, SIGNAL(bytesWritten(qint64)), this, SLOT(bytesWritten()));
+        connect(socket, SIGNAL(disconnected()), this, SLOT(disconnected()));
+        // 0 addresses every connection
+        if (++nextConnection == 0)
+            ++nextConnection;
+        Connection *connection = new Connection(nextConnection, socket, local);
+        connections.insert(connection->id, connection);
+        sockets.insert(socket, connection);
+    }
+
+    QSet<Connection *> touched;
+    foreach (const Outgoing &outgoing, messages) {
+        if (!outgoing.broadcast || outgoing.connection) {
+            Connection *connection = connections.value(outgoing.connection);
+            if (!connection)
+                continue;
+            if (!outgoing.broadcast && outgoing.message.type != QtRemoteModel::PartialReturn)
+                connection->requests--;
+            if (connection->resuming && !outgoing.broadcast && outgoing.message.id == connection->resumeId)
+                resumed(connection, outgoing);
+            else
+                queue(connection, outgoing);
+            touched.insert(connection);
+            continue;
+        }
+        quint32 channel = outgoing.broadcast->message.channel;
+        if (!channel)
+            sequence = outgoing.broadcast->message.id;
+        foreach (Connection *connection, connections) {
+            if (channel && !connection->channels.contains(channel))
+                continue;
+            if (connection->resuming && !channel) {
+                connection->paused.append(outgoing);
+                continue;
+            }
+            queue(connection, outgoing);
+            touched.insert(connection);
+        }
+    }
+    foreach (Connection *connection, touched) {
+        flush(connection);
+        unstall(connection);
+    }
+}
+
+// the journal went out ahead of the answer; of the changes paused
+// meanwhile only the newer ones follow, or none when the client starts over
+void Worker::resumed(Connection *connection, const Outgoing &reply)
+{
+    queue(connection, reply);
+    bool ok = reply.message.type == QtRemoteModel::MethodReturn && reply.message.value.toList().value(0).toBool();
+    QList<Outgoing> paused;
+    paused.swap(connection->paused);
+    connection->resuming = false;
+    connection->resumeId = 0;
+    if (!ok)
+        return;
+    foreach (const Outgoing &outgoing, paused) {
+        if (outgoing.broadcast->message.id > connection->sequence)
+            queue(connection, outgoing);
+    }
+}
+
+static bool sameCells(const QRemoteModelMessage &message, const QRemoteModelMessage &other)
+{
+    return message.channel == other.channel && message.args.mid(0, 3) == other.args.mid(0, 3);
+}
+
+// the channel, cell range and roles of a dataChanged
+static QByteArray cellsKey(const QRemoteModelMessage &message)
+{
+    QByteArray key;
+    QDataStream stream(&key, QIODevice::WriteOnly);
+    stream << message.channel << message.args.mid(0, 3);
+    return key;
+}
+
+void Worker::queue(Connection *connection, const Outgoing &outgoing)
+{
+    // rate limited clients get the signals of a transaction one by one so
+    // that its value changes can be held back
+    if (outgoing.broadcast && !outgoing.broadcast->parts.isEmpty()
+            && (connection->version < QRemoteModelProtocol::Version3 || connection->updateInterval > 0
+                || connection->subscriptions.contains(outgoing.broadcast->message.channel))) {
+        foreach (const QSharedPointer<SharedFrames> &part, outgoing.broadcast->parts) {
+            Outgoing signal;
+            signal.connection = 0;
+            signal.broadcast = part;
+            queue(connection, signal);
+        }
+        return;
     }
-    data = qCompress(data);
-    int length = data.length();
-    qDebug() << length << uuid << signal << args;
-    QByteArray header(QtRemoteModel::HeaderLength, Qt::Uninitialized);
-    for (int i = 0; i < QtRemoteModel::HeaderLength; i++) {
-        header[0] = (length & 0xff000000) << 24;
-        header[1] = (length & 0x00ff0000) << 16;
-        header[2] = (length & 0x0000ff00) <<  8;
-        header[3] = (length & 0x000000ff);
+    if (outgoing.broadcast && outgoing.broadcast->message.id && !outgoing.broadcast->message.channel)
+        connection->sequence = outgoing.broadcast->message.id;
+    if (outgoing.broadcast) {
+        const QRemoteModelMessage &message = outgoing.broadcast->message;
+        if (message.opcode != QRemoteModelProtocol::DataChanged && message.opcode != QRemoteModelProtocol::HeaderDataChanged)
+            connection->structures.insert(message.channel, message.id);
+        if (connection->subscriptions.contains(message.channel)) {
+            Outgoing filtered = outgoing;
+            if (filter(connection, &filtered))
+                hold(connection, filtered);
+            return;
+        }
+    }
+    hold(connection, outgoing);
+}
+
+void Worker::hold(Connection *connection, const Outgoing &outgoing)
+{
+    if (outgoing.broadcast && connection->updateInterval > 0) {
+        const QRemoteModelMessage &message = outgoing.broadcast->message;
+        if (message.opcode != QRemoteModelProtocol::DataChanged) {
+            // values held back must not end up behind a change of structure
+            release(connection);
+        } else if (connection->updateTimer) {
+            // the latest values go after whatever was held in between
+            QByteArray key = cellsKey(message);
+            QHash<QByteArray, int>::iterator i = connection->heldCells.find(key);
+            if (i != connection->heldCells.end())
+                connection->held[i.value()] = Outgoing();
+            connection->heldCells.insert(key, connection->held.count());
+            connection->held.append(outgoing);
+            if (connection->held.count() > 2 * connection->heldCells.count() + 16)
+                compactHeld(connection);
+            return;
+        } else {
+            // the first update after a quiet interval goes out right away
+            connection->updateTimer = startTimer(connection->updateInterval);
+            timers.insert(connection->updateTimer, connection);
+        }
+    }
+    append(connection, outgoing);
+}
+
+static bool covers(const Region &region, const QVariantList &topLeft, const QVariantList &bottomRight)
+{
+    int depth = region.parent.count();
+    if (topLeft.count() <= depth || bottomRight.count() != topLeft.count())
+        return false;
+    for (int i = 0; i < depth; i++) {
+        if (topLeft.at(i).toPoint() != region.parent.at(i).toPoint())
+            return false;
+    }
+    // a change further down lies below a single row of the region
+    int top = topLeft.at(depth).toPoint().y();
+    int bottom = topLeft.count() == depth + 1 ? bottomRight.at(depth).toPoint().y() : top;
+    return bottom >= region.first && (region.last < 0 || top <= region.last);
+}
+
+// drops value changes outside the regions of the client and the pushed
+// values of roles it did not ask for; false when nothing is left
+bool Worker::filter(Connection *connection, Outgoing *outgoing)
+{
+    const QRemoteModelMessage &message = outgoing->broadcast->message;
+    if (message.opcode != QRemoteModelProtocol::DataChanged)
+        return true;
+    const Subscription &subscription = connection->subscriptions[message.channel];
+    // row numbers of regions which predate a change of structure are
+    // meaningless until the client subscribes again
+    bool current = !connection->structures.contains(message.channel)
+            || qint32(subscription.seen - connection->structures.value(message.channel)) >= 0;
+    if (current) {
+        QVariantList topLeft = message.args.value(0).toList();
+        QVariantList bottomRight = message.args.value(1).toList();
+        bool watched = false;
+        foreach (const Region &region, subscription.regions) {
+            if (covers(region, topLeft, bottomRight)) {
+                watched = true;
+                break;
+            }
+        }
+        if (!watched)
+            return false;
+    }
+    if (subscription.roles.isEmpty() || message.args.count() < 5)
+        return true;
+
+    int i = 3;
+    QVariantList values = message.args.at(i++).toList();
+    QVariantList valueRoles = message.args.at(i++).toList();
+    QList<int> kept;
+    for (int j = 0; j < valueRoles.count(); j++) {
+        if (subscription.roles.contains(valueRoles.at(j).toInt()))
+            kept.append(j);
+    }
+    if (kept.count() == valueRoles.count())
+        return true;
+    QRemoteModelMessage stripped = message;
+    // without values the client just forgets the changed ones
+    stripped.args = message.args.mid(0, 3);
+    if (!kept.isEmpty()) {
+        QVariantList keptValues;
+        QVariantList keptRoles;
+        foreach (int j, kept)
+            keptRoles.append(valueRoles.at(j));
+        for (int offset = 0; offset + valueRoles.count() <= values.count(); offset += valueRoles.count()) {
+            foreach (int j, kept)
+                keptValues.append(values.at(offset + j));
+        }
+        stripped.args << QVariant(keptValues) << QVariant(keptRoles);
+    }
+    outgoing->broadcast = QSharedPointer<SharedFrames>::create(stripped);
+    return true;
+}
+
+// drops the entries of replaced updates
+void Worker::compactHeld(Connection *connection)
+{
+    QList<Outgoing> held;
+    held.swap(connection->held);
+    connection->heldCells.clear();
+    foreach (const Outgoing &outgoing, held) {
+        if (!outgoing.broadcast)
+            continue;
+        connection->heldCells.insert(cellsKey(outgoing.broadcast->message), connection->held.count());
+        connection->held.append(outgoing);
+    }
+}
+
+void Worker::release(Connection *connection)
+{
+    QList<Outgoing> held;
+    held.swap(connection->held);
+    connection->heldCells.clear();
+    foreach (const Outgoing &outgoing, held) {
+        if (outgoing.broadcast)
+            append(connection, outgoing);
     }
-    foreach (QTcpSocket *socket, clients) {
-        if (socket->write(header) != header.length())
-            Q_UNREACHABLE();
-        if (socket->write(data) != data.length())
-            Q_UNREACHABLE();
+}
+
+static qint64 sizeOf(const Outgoing &outgoing, int version)
+{
+    return outgoing.broadcast ? outgoing.broadcast->payload(version).length() : outgoing.payload.length();
+}
+
+void Worker::append(Connection *connection, const Outgoing &outgoing)
+{
+    if (outgoing.broadcast) {
+        if (connection->resync)
+            return;
+        if (connection->queuedBytes >= ResyncLimit) {
+            // past the hard limit the signals go, the answers stay
+            qCWarning(lcRemoteModel) << "client" << connection->id << "fell behind, resetting it";
+            QList<Outgoing> replies;
+            connection->queuedBytes = 0;
+            foreach (const Outgoing &queued, connection->queue) {
+                if (queued.broadcast)
+                    continue;
+                replies.append(queued);
+                connection->queuedBytes += queued.payload.length();
+            }
+            connection->queue = replies;
+            connection->held.clear();
+            connection->heldCells.clear();
+            connection->resync = true;
+            return;
+        }
+        if (connection->queuedBytes >= ConflateLimit && outgoing.broadcast->message.opcode == QRemoteModelProtocol::DataChanged)
+            conflate(connection, outgoing.broadcast->message);
+        connection->queue.append(outgoing);
+    } else {
+        Outgoing reply = outgoing;
+        reply.payload = QRemoteModelProtocol::encode(reply.message, connection->version);
+        connection->queue.append(reply);
     }
+    connection->queuedBytes += sizeOf(connection->queue.last(), connection->version);
+}
+
+// over the hard limit nothing more is read from the client
+bool Worker::saturated(Connection *connection) const
+{
+    return connection->requests >= MaximumRequests
+            || connection->queuedBytes + connection->socket->bytesToWrite() >= ResyncLimit;
+}
+
+void Worker::unstall(Connection *connection)
+{
+    if (!connection->stalled || saturated(connection))
+        return;
+    connection->stalled = false;
+    read(connection);
+}
+
+// drops an earlier dataChanged of the same cells and roles, unless a
+// structural signal came in between
+void Worker::conflate(Connection *connection, const QRemoteModelMessage &message)
+{
+    for (int i = connection->queue.count() - 1; i >= 0; i--) {
+        const SharedFrames *broadcast = connection->queue.at(i).broadcast.data();
+        if (!broadcast || broadcast->message.opcode == QRemoteModelProtocol::HeaderDataChanged)
+            continue;
+        if (broadcast->message.opcode != QRemoteModelProtocol::DataChanged)
+            return;
+        if (sameCells(broadcast->message, message)) {
+            connection->queuedBytes -= sizeOf(connection->queue.takeAt(i), connection->version);
+            return;
+        }
+    }
+}
+
+// frames are encoded when the socket takes them; a shared one is never
+// copied before that
+void Worker::flush(Connection *connection)
+{
+    QMutexLocker locker(&compressorMutex);
+    while (connection->socket->bytesToWrite() < HighWatermark) {
+        if (connection->queue.isEmpty()) {
+            if (!connection->resync)
+                break;
+            // caught up, the client fetches every model again and
+            // subscribes anew
+            connection->subscriptions.clear();
+            QList<quint32> channels = connection->channels.toList();
+            channels.prepend(0);
+            foreach (quint32 channel, channels) {
+                QRemoteModelMessage message;
+                message.type = QtRemoteModel::EmitSignal;
+                message.name = QByteArrayLiteral("modelReset");
+                message.opcode = QRemoteModelProtocol::ModelReset;
+                message.channel = channel;
+                // the snapshot covers the changes dropped until now
+                if (!channel)
+                    message.id = connection->sequence;
+                Outgoing reset;
+                reset.connection = 0;
+                reset.broadcast = QSharedPointer<SharedFrames>::create(message);
+                connection->queue.append(reset);
+                connection->queuedBytes += sizeOf(reset, connection->version);
+            }
+            connection->resync = false;
+        }
+        Outgoing outgoing = connection->queue.takeFirst();
+        int version = connection->version;
+        connection->queuedBytes -= sizeOf(outgoing, version);
+        if (connection->local && version >= QRemoteModelProtocol::Version3) {
+            // nothing is compressed on this host
+            if (outgoing.broadcast) {
+                send(connection, outgoing.broadcast->rawFrame(version));
+                continue;
+            }
+            // segments the client has not released yet count against the
+            // limit, past it the answer takes the socket
+            if (outgoing.payload.length() >= SharedMemoryThreshold && connection->sharedBytes + outgoing.payload.length() <= ResyncLimit)
+                share(connection, outgoing.message.id, outgoing.payload);
+            else
+                send(connection, QRemoteModelProtocol::frame(outgoing.payload, version));
+        } else if (!outgoing.broadcast)
+            send(connection, QRemoteModelProtocol::frame(outgoing.payload, version, &compressor, connection->stream));
+        else if (connection->stream)
+            send(connection, QRemoteModelProtocol::frame(outgoing.broadcast->payload(version), version, &compressor, connection->stream));
+        else
+            send(connection, outgoing.broadcast->frame(version, &compressor));
+    }
+}
+
+void Worker::bytesWritten()
+{
+    QIODevice *socket = qobject_cast<QIODevice *>(sender());
+    Connection *connection = sockets.value(socket);
+    if (!connection)
+        return;
+    if (!connection->queue.isEmpty() && socket->bytesToWrite() <= LowWatermark)
+        flush(connection);
+    unstall(connection);
+}
+
+void Worker::readData()
+{
+    Connection *connection = sockets.value(qobject_cast<QIODevice *>(sender()));
+    if (connection && !connection->stalled)
+        read(connection);
+}
+
+void Worker::read(Connection *connection)
+{
+    QIODevice *socket = connection->socket;
+    QList<Request> requests;
+    bool opened = false;
+    bool broken = false;
+    QMutexLocker locker(&compressorMutex);
+    forever {
+        if (saturated(connection)) {
+            // the rest waits in the socket until the client reads its answers
+            connection->stalled = true;
+            break;
+        }
+        QRemoteModelMessage message;
+        QRemoteModelProtocol::FrameStatus status = QRemoteModelProtocol::readFrame(socket, &message, &compressor);
+        if (status == QRemoteModelProtocol::BrokenFrame)
+            broken = true;
+        if (status != QRemoteModelProtocol::FrameRead)
+            break;
+        if (message.type != QtRemoteModel::MethodCall) {
+            qCWarning(lcRemoteModel) << "unexpected frame" << message.type << message.id;
+            continue;
+        }
+        if (message.opcode == QRemoteModelProtocol::Hello) {
+            hello(connection, message);
+            continue;
+        }
+        if (message.opcode == QRemoteModelProtocol::Open) {
+            open(connection, message);
+            opened = true;
+            continue;
+        }
+        if (message.opcode == QRemoteModelProtocol::Subscribe) {
+            subscribe(connection, message);
+            continue;
+        }
+        if (message.opcode == QRemoteModelProtocol::Release) {
+            QSharedMemory *segment = connection->segments.take(message.args.value(0).toString());
+            if (segment)
+                connection->sharedBytes -= segment->size();
+            delete segment;
+            continue;
+        }
+        if (message.opcode == QRemoteModelProtocol::Resume)
+            connection->resumeId = message.id;
+        Request request;
+        request.worker = this;
+        request.connection = connection->id;
+        request.local = connection->local && connection->version >= QRemoteModelProtocol::Version3;
+        request.message = message;
+        requests.append(request);
+        connection->requests++;
+    }
+    locker.unlock();
+    if (broken) {
+        // disconnected() takes the connection along
+        qCWarning(lcRemoteModel) << "closing client" << connection->id;
+        socket->close();
+        return;
+    }
+    if (opened)
+        flush(connection);
+    if (!requests.isEmpty())
+        dispatch(requests);
+}
+
+// the signals of the model follow its answer, which is the channel or 0
+// when there is no model of that name
+void Worker::open(Connection *connection, const QRemoteModelMessage &message)
+{
+    quint32 channel = 0;
+    if (connection->version >= QRemoteModelProtocol::Version3)
+        channel = channels.value(message.args.value(0).toString());
+    if (channel)
+        connection->channels.insert(channel);
+    else
+        qCWarning(lcRemoteModel) << "no model named" << message.args.value(0).toString();
+    Outgoing reply;
+    reply.connection = connection->id;
+    reply.message.type = QtRemoteModel::MethodReturn;
+    reply.message.id = message.id;
+    reply.message.value = channel;
+    queue(connection, reply);
+}
+
+// no regions lifts the filter again
+void Worker::subscribe(Connection *connection, const QRemoteModelMessage &message)
+{
+    if (connection->version < QRemoteModelProtocol::Version3)
+        return;
+    int i = 0;
+    QVariantList regions = message.args.value(i++).toList();
+    QVariantList roles = message.args.value(i++).toList();
+    if (regions.isEmpty()) {
+        connection->subscriptions.remove(message.channel);
+        return;
+    }
+    Subscription subscription;
+    foreach (const QVariant &value, regions) {
+        QVariantList args = value.toList();
+        int j = 0;
+        Region region;
+        region.parent = args.value(j++).toList();
+        region.first = args.value(j++).toInt();
+        region.last = args.value(j++).toInt();
+        subscription.regions.append(region);
+    }
+    foreach (const QVariant &role, roles)
+        subscription.roles.insert(role.toInt());
+    subscription.seen = message.args.value(i++).toUInt();
+    connection->subscriptions.insert(message.channel, subscription);
+}
+
+// answered right away, the frames encoded afterwards use the agreed version
+// and streaming context
+void Worker::hello(Connection *connection, const QRemoteModelMessage &message)
+{
+    int i = 0;
+    int version = message.args.value(i++).toInt();
+    bool streamingRequested = message.args.value(i++).toBool();
+    int maximumUpdateRate = message.args.value(i++).toInt();
+    // the resume call follows, changes wait for its answer
+    connection->resuming = message.args.value(i++).toBool();
+    connection->version = qBound<int>(QRemoteModelProtocol::Version1, version, QRemoteModelProtocol::CurrentVersion);
+    bool streaming = streamingCompression && compressor.level != 0 && !connection->local
+            && connection->version > QRemoteModelProtocol::Version1 && streamingRequested;
+    connection->updateInterval = maximumUpdateRate > 0 ? qMax(1, 1000 / maximumUpdateRate) : 0;
+    QRemoteModelMessage reply;
+    reply.type = QtRemoteModel::MethodReturn;
+    reply.id = message.id;
+    reply.value = QVariantList() << connection->version << streaming << epoch << sequence;
+    // the answer itself is still compressed on its own
+    send(connection, QRemoteModelProtocol::frame(reply, connection->version, &compressor, connection->stream));
+    if (streaming && !connection->stream)
+        connection->stream = new QRemoteModelZStream(QRemoteModelZStream::Deflate, compressor.level);
+}
+
+// the segment stays until the client released it or disconnected; only
+// its name and size go through the socket
+void Worker::share(Connection *connection, quint32 id, const QByteArray &payload)
+{
+    QString key = QStringLiteral("qtremotemodel-%1-%2-%3").arg(QCoreApplication::applicationPid()).arg(quintptr(this)).arg(++nextSegment);
+    QSharedMemory *segment = new QSharedMemory(key);
+    if (!segment->create(payload.length())) {
+        qCWarning(lcRemoteModel) << segment->errorString();
+        delete segment;
+        send(connection, QRemoteModelProtocol::frame(payload, connection->version));
+        return;
+    }
+    memcpy(segment->data(), payload.constData(), payload.length());
+    connection->segments.insert(key, segment);
+    connection->sharedBytes += segment->size();
+    QRemoteModelMessage descriptor;
+    descriptor.type = QtRemoteModel::SharedReturn;
+    descriptor.id = id;
+    descriptor.value = QVariantList() << key << payload.length();
+    send(connection, QRemoteModelProtocol::frame(descriptor, connection->version));
+}
+
+// a frame is header and body in one buffer, written in one go
+void Worker::send(Connection *connection, const QByteArray &frame)
+{
+    if (connection->socket->write(frame) != frame.length())
+        qCWarning(lcRemoteModel) << connection->socket->errorString();
+}
+
+// sends what was held back during the interval, and stops once nothing was
+void Worker::timerEvent(QTimerEvent *event)
+{
+    Connection *connection = timers.value(event->timerId());
+    if (!connection) {
+        QObject::timerEvent(event);
+        return;
+    }
+    if (connection->held.isEmpty()) {
+        killTimer(connection->updateTimer);
+        timers.remove(connection->updateTimer);
+        connection->updateTimer = 0;
+        return;
+    }
+    release(connection);
+    flush(connection);
+}
+
+void Worker::disconnected()
+{
+    QIODevice *socket = qobject_cast<QIODevice *>(sender());
+    Connection *connection = sockets.take(socket);
+    if (connection) {
+        if (connection->updateTimer) {
+            killTimer(connection->updateTimer);
+            timers.remove(connection->updateTimer);
+        }
+        delete connections.take(connection->id);
+    }
+    socket->deleteLater();
 }
 
 
@@ -597,15 +2130,148 @@ QAbstractItemModel *QRemoteModelServer::model() const
 void QRemoteModelServer::setModel(QAbstractItemModel *model)
 {
     if (d->model == model) return;
-    d->disconnectModel();
-	d->model = model;
-    d->connectModel();
+    d->setModel(model);
+    d->configureWorkers();
 	emit modelChanged(model);
 }
 
+bool QRemoteModelServer::pushValues() const
+{
+    return d->pushValues;
+}
+
+void QRemoteModelServer::setPushValues(bool pushValues)
+{
+    if (d->pushValues == pushValues) return;
+    d->pushValues = pushValues;
+    emit pushValuesChanged(pushValues);
+}
+
+int QRemoteModelServer::compressionThreshold() const
+{
+    return d->compressor.threshold;
+}
+
+void QRemoteModelServer::setCompressionThreshold(int compressionThreshold)
+{
+    if (d->compressor.threshold == compressionThreshold) return;
+    d->compressor.threshold = compressionThreshold;
+    d->configureWorkers();
+    emit compressionThresholdChanged(compressionThreshold);
+}
+
+int QRemoteModelServer::compressionLevel() const
+{
+    return d->compressor.level;
+}
+
+void QRemoteModelServer::setCompressionLevel(int compressionLevel)
+{
+    if (d->compressor.level == compressionLevel) return;
+    d->compressor.level = compressionLevel;
+    d->configureWorkers();
+    emit compressionLevelChanged(compressionLevel);
+}
+
+bool QRemoteModelServer::streamingCompression() const
+{
+    return d->streamingCompression;
+}
+
+// applies to the clients connecting afterwards
+void QRemoteModelServer::setStreamingCompression(bool streamingCompression)
+{
+    if (d->streamingCompression == streamingCompression) return;
+    d->streamingCompression = streamingCompression;
+    d->configureWorkers();
+    emit streamingCompressionChanged(streamingCompression);
+}
+
+// serves model next to the default one; clients open it by name with
+// QRemoteModelClient::connectToModel() over the connection they have
+void QRemoteModelServer::registerModel(const QString &name, QAbstractItemModel *model)
+{
+    d->registerModel(name, model);
+}
+
+// names of the built-in methods are reserved
+void QRemoteModelServer::registerMethod(const QByteArray &name, const Method &method)
+{
+    if (QRemoteModelProtocol::opcode(name) != QRemoteModelProtocol::ExtensionOpcode) {
+        qCWarning(lcRemoteModel) << name << "is a built-in method";
+        return;
+    }
+    if (method)
+        d->methods.insert(name, method);
+    else
+        d->methods.remove(name);
+}
+
+// the sum over all I/O threads
+QVariantMap QRemoteModelServer::compressionStatistics() const
+{
+    QVariantMap ret;
+    foreach (Worker *worker, d->workers) {
+        QMapIterator<QString, QVariant> i(worker->statistics());
+        while (i.hasNext()) {
+            i.next();
+            ret.insert(i.key(), ret.value(i.key()).toDouble() + i.value().toDouble());
+        }
+    }
+    double bytesIn = ret.value(QStringLiteral("bytesIn")).toDouble();
+    ret.insert(QStringLiteral("ratio"), bytesIn > 0 ? ret.value(QStringLiteral("bytesOut")).toDouble() / bytesIn : 1.0);
+    return ret;
+}
+
+int QRemoteModelServer::ioThreads() const
+{
+    return d->ioThreads;
+}
+
+// 0 does all socket work on the thread of the server; the threads are
+// started when the first client connects, later changes have no effect
+void QRemoteModelServer::setIoThreads(int ioThreads)
+{
+    if (d->ioThreads == ioThreads) return;
+    d->ioThreads = ioThreads;
+    emit ioThreadsChanged(ioThreads);
+}
+
+int QRemoteModelServer::coalescingLatency() const
+{
+    return d->coalescingLatency;
+}
+
+// -1 sends every change right away, 0 coalesces the changes of one event
+// loop iteration and a positive value holds them for up to that many msecs
+void QRemoteModelServer::setCoalescingLatency(int coalescingLatency)
+{
+    if (d->coalescingLatency == coalescingLatency) return;
+    d->coalescingLatency = coalescingLatency;
+    d->flushChanges();
+    foreach (Private *named, d->models)
+        named->flushChanges();
+    emit coalescingLatencyChanged(coalescingLatency);
+}
+
+int QRemoteModelServer::journalSize() const
+{
+    return d->journalSize;
+}
+
+// the number of recent changes kept for clients that reconnect, 0 keeps none
+void QRemoteModelServer::setJournalSize(int journalSize)
+{
+    if (d->journalSize == journalSize) return;
+    d->journalSize = journalSize;
+    while (d->journal.count() > qMax(0, journalSize))
+        d->journal.removeFirst();
+    emit journalSizeChanged(journalSize);
+}
+
 bool QRemoteModelServer::isListening() const
 {
-    return d->isListening();
+    return d->isListening() || (d->localServer && d->localServer->isListening());
 }
 
 bool QRemoteModelServer::listen(const QHostAddress &address, quint16 port)
@@ -613,6 +2279,18 @@ bool QRemoteModelServer::listen(const QHostAddress &address, quint16 port)
     return d->listen(address, port);
 }
 
+// clients on this host connect with QRemoteModelClient::connectToServer();
+// they skip compression and get large answers through shared memory
+bool QRemoteModelServer::listen(const QString &name)
+{
+    return d->listenLocal(name);
+}
+
+QString QRemoteModelServer::serverName() const
+{
+    return d->localServer ? d->localServer->fullServerName() : QString();
+}
+
 QHostAddress QRemoteModelServer::serverAddress() const
 {
     return d->serverAddress();
@@ -29,30 +29,72 @@
 
 #include "qtremotemodel_global.h"
 #include <QtCore/QObject>
+#include <QtCore/QVariantMap>
 #include <QtNetwork/QHostAddress>
 
+#include <functional>
+
 class QAbstractItemModel;
 
 class QTREMOTEMODEL_EXPORT QRemoteModelServer : public QObject
 {
     Q_OBJECT
     Q_PROPERTY(QAbstractItemModel *model READ model WRITE setModel NOTIFY modelChanged)
+    Q_PROPERTY(bool pushValues READ pushValues WRITE setPushValues NOTIFY pushValuesChanged)
+    Q_PROPERTY(int compressionThreshold READ compressionThreshold WRITE setCompressionThreshold NOTIFY compressionThresholdChanged)
+    Q_PROPERTY(int compressionLevel READ compressionLevel WRITE setCompressionLevel NOTIFY compressionLevelChanged)
+    Q_PROPERTY(bool streamingCompression READ streamingCompression WRITE setStreamingCompression NOTIFY streamingCompressionChanged)
+    Q_PROPERTY(int ioThreads READ ioThreads WRITE setIoThreads NOTIFY ioThreadsChanged)
+    Q_PROPERTY(int coalescingLatency READ coalescingLatency WRITE setCoalescingLatency NOTIFY coalescingLatencyChanged)
+    Q_PROPERTY(int journalSize READ journalSize WRITE setJournalSize NOTIFY journalSizeChanged)
 public:
+    typedef std::function<QVariant(const QVariantList &args)> Method;
+
     explicit QRemoteModelServer(QObject *parent = 0);
     ~QRemoteModelServer();
 
     bool isListening() const;
     bool listen(const QHostAddress &address = QHostAddress::Any, quint16 port = 0);
+    bool listen(const QString &name);
     QHostAddress serverAddress() const;
     quint16 serverPort() const;
+    QString serverName() const;
 
     QAbstractItemModel *model() const;
+    bool pushValues() const;
+    int compressionThreshold() const;
+    int compressionLevel() const;
+    bool streamingCompression() const;
+    int ioThreads() const;
+    int coalescingLatency() const;
+    int journalSize() const;
+
+    // another model on the same port, 0 leaves the name without one
+    Q_INVOKABLE void registerModel(const QString &name, QAbstractItemModel *model);
+    // answers calls of the name from QRemoteModelClient::call()
+    void registerMethod(const QByteArray &name, const Method &method);
+
+    Q_INVOKABLE QVariantMap compressionStatistics() const;
 
 public Q_SLOTS:
     void setModel(QAbstractItemModel *model);
+    void setPushValues(bool pushValues);
+    void setCompressionThreshold(int compressionThreshold);
+    void setCompressionLevel(int compressionLevel);
+    void setStreamingCompression(bool streamingCompression);
+    void setIoThreads(int ioThreads);
+    void setCoalescingLatency(int coalescingLatency);
+    void setJournalSize(int journalSize);
 
 signals:
     void modelChanged(QAbstractItemModel *model);
+    void pushValuesChanged(bool pushValues);
+    void compressionThresholdChanged(int compressionThreshold);
+    void compressionLevelChanged(int compressionLevel);
+    void streamingCompressionChanged(bool streamingCompression);
+    void ioThreadsChanged(int ioThreads);
+    void coalescingLatencyChanged(int coalescingLatency);
+    void journalSizeChanged(int journalSize);
 
 private:
     class Private;
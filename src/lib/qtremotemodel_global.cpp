@@ -2,6 +2,28 @@
 
 #include <QtCore/QPoint>
 
+QByteArray QtRemoteModel::encodeHeader(qint64 length, int flags) {
+    Q_ASSERT(length < 0x40000000);
+    QByteArray ret(HeaderLength, Qt::Uninitialized);
+    ret[0] = static_cast<char>(((length >> 24) & 0x3f) | (flags & 0xc0));
+    ret[1] = static_cast<char>((length >> 16) & 0xff);
+    ret[2] = static_cast<char>((length >>  8) & 0xff);
+    ret[3] = static_cast<char>(length & 0xff);
+    return ret;
+}
+
+qint64 QtRemoteModel::decodeHeader(const QByteArray &header, int *flags) {
+    const uchar *data = reinterpret_cast<const uchar *>(header.constData());
+    if (flags)
+        *flags = data[0] & 0xc0;
+    qint64 ret = 0;
+    ret |= static_cast<qint64>(data[0] & 0x3f) << 24;
+    ret |= static_cast<qint64>(data[1]) << 16;
+    ret |= static_cast<qint64>(data[2]) <<  8;
+    ret |= static_cast<qint64>(data[3]);
+    return ret;
+}
+
 QVariant QtRemoteModel::fromModelIndex(const QModelIndex &index) {
     QVariantList ret;
     for (QModelIndex i = index; i.isValid(); i = i.parent()) {
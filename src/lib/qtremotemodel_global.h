@@ -40,8 +40,13 @@
 class QtRemoteModel
 {
 public:
-    enum { HeaderLength = 4 };
-    enum CallType { MethodCall, MethodReturn, EmitSignal };
+    enum { HeaderLength = 4, ChunkSize = 64 * 1024 };
+    // a SharedReturn names the shared memory holding the encoded answer
+    enum CallType { MethodCall, MethodReturn, EmitSignal, PartialReturn, ErrorReturn, SharedReturn };
+
+    // the top two bits of the header carry frame flags
+    static QByteArray encodeHeader(qint64 length, int flags = 0);
+    static qint64 decodeHeader(const QByteArray &header, int *flags = 0);
 
     static QVariant fromModelIndex(const QModelIndex &index);
     static QModelIndex toModelIndex(const QAbstractItemModel *model, const QVariant &value);
@@ -0,0 +1,5 @@
+CONFIG += testcase
+TARGET = tst_qremotemodelclient
+QT = core gui network testlib remotemodel
+
+SOURCES = tst_qremotemodelclient.cpp
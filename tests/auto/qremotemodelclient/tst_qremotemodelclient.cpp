@@ -0,0 +1,261 @@
+/* Copyright (c) 2015 Tasuku Suzuki.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Tasuku Suzuki nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL TASUKU SUZUKI BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtTest/QtTest>
+#include <QtCore/QStringListModel>
+#include <QtGui/QStandardItemModel>
+
+#include <QtRemoteModel/QRemoteModelServer>
+#include <QtRemoteModel/QRemoteModelClient>
+
+// every structural update of the mirror is validated in this test, an
+// inconsistent one ends it
+class tst_QRemoteModelClient : public QObject
+{
+    Q_OBJECT
+private slots:
+    void initTestCase();
+    void cleanup();
+
+    void insertRows();
+    void removeRows();
+    void moveRows();
+    void insertChildren();
+    void removeChildren();
+    void sort();
+    void structureChanges_data();
+    void structureChanges();
+
+private:
+    bool serve(QAbstractItemModel *model);
+    static QStringList dump(const QAbstractItemModel *model, const QModelIndex &parent = QModelIndex());
+    static QList<QStandardItem *> items(const QString &prefix, int count);
+
+    QRemoteModelServer *server;
+    QRemoteModelClient *client;
+    QAbstractItemModel *source;
+};
+
+void tst_QRemoteModelClient::initTestCase()
+{
+    // read once, before the first update
+    qputenv("QT_REMOTEMODEL_CHECK", "1");
+    server = Q_NULLPTR;
+    client = Q_NULLPTR;
+    source = Q_NULLPTR;
+}
+
+void tst_QRemoteModelClient::cleanup()
+{
+    delete client;
+    client = Q_NULLPTR;
+    delete server;
+    server = Q_NULLPTR;
+    delete source;
+    source = Q_NULLPTR;
+}
+
+// true once the client mirrors the model
+bool tst_QRemoteModelClient::serve(QAbstractItemModel *model)
+{
+    static int serial = 0;
+    QString name = QStringLiteral("tst_qremotemodelclient-%1-%2").arg(QCoreApplication::applicationPid()).arg(++serial);
+    source = model;
+    server = new QRemoteModelServer;
+    server->setModel(model);
+    if (!server->listen(name))
+        return false;
+    client = new QRemoteModelClient;
+    client->connectToServer(name);
+    return QTest::qWaitFor([this]() { return dump(client) == dump(source); });
+}
+
+QStringList tst_QRemoteModelClient::dump(const QAbstractItemModel *model, const QModelIndex &parent)
+{
+    QStringList ret;
+    for (int row = 0; row < model->rowCount(parent); row++) {
+        QModelIndex index = model->index(row, 0, parent);
+        ret.append(index.data().toString());
+        foreach (const QString &child, dump(model, index))
+            ret.append(index.data().toString() + QLatin1Char('/') + child);
+    }
+    return ret;
+}
+
+QList<QStandardItem *> tst_QRemoteModelClient::items(const QString &prefix, int count)
+{
+    QList<QStandardItem *> ret;
+    for (int i = 0; i < count; i++)
+        ret.append(new QStandardItem(prefix + QString::number(i)));
+    return ret;
+}
+
+void tst_QRemoteModelClient::insertRows()
+{
+    QStandardItemModel *model = new QStandardItemModel;
+    model->appendColumn(items(QStringLiteral("a"), 10));
+    QVERIFY(serve(model));
+
+    model->insertRow(0, new QStandardItem(QStringLiteral("first")));
+    model->insertRow(model->rowCount(), new QStandardItem(QStringLiteral("last")));
+    model->insertRow(5, new QStandardItem(QStringLiteral("middle")));
+    QTRY_COMPARE(dump(client), dump(model));
+
+    for (int i = 0; i < 100; i++)
+        model->insertRow(i % 7, new QStandardItem(QString::number(i)));
+    QTRY_COMPARE(dump(client), dump(model));
+}
+
+void tst_QRemoteModelClient::removeRows()
+{
+    QStandardItemModel *model = new QStandardItemModel;
+    model->appendColumn(items(QStringLiteral("a"), 200));
+    QVERIFY(serve(model));
+
+    model->removeRow(0);
+    model->removeRow(model->rowCount() - 1);
+    model->removeRows(50, 20);
+    QTRY_COMPARE(dump(client), dump(model));
+
+    while (model->rowCount() > 3)
+        model->removeRows(model->rowCount() / 2, 3);
+    QTRY_COMPARE(dump(client), dump(model));
+
+    model->removeRows(0, model->rowCount());
+    QTRY_COMPARE(client->rowCount(), 0);
+}
+
+void tst_QRemoteModelClient::moveRows()
+{
+    QStringList strings;
+    for (int i = 0; i < 100; i++)
+        strings.append(QString::number(i));
+    QStringListModel *model = new QStringListModel(strings);
+    QVERIFY(serve(model));
+
+    // down, up, and a block to either end
+    QVERIFY(model->moveRows(QModelIndex(), 0, 1, QModelIndex(), 10));
+    QVERIFY(model->moveRows(QModelIndex(), 50, 1, QModelIndex(), 20));
+    QVERIFY(model->moveRows(QModelIndex(), 30, 10, QModelIndex(), 0));
+    QVERIFY(model->moveRows(QModelIndex(), 0, 10, QModelIndex(), model->rowCount()));
+    QTRY_COMPARE(dump(client), dump(model));
+
+    for (int i = 0; i < 50; i++) {
+        int first = (i * 13) % 90;
+        int count = 1 + i % 5;
+        int destination = (i * 29) % 100;
+        // no move onto itself
+        if (destination >= first && destination <= first + count)
+            continue;
+        QVERIFY(model->moveRows(QModelIndex(), first, count, QModelIndex(), destination));
+    }
+    QTRY_COMPARE(dump(client), dump(model));
+}
+
+void tst_QRemoteModelClient::insertChildren()
+{
+    QStandardItemModel *model = new QStandardItemModel;
+    model->appendColumn(items(QStringLiteral("a"), 10));
+    model->item(3)->appendRows(items(QStringLiteral("b"), 5));
+    QVERIFY(serve(model));
+
+    model->item(3)->insertRow(0, new QStandardItem(QStringLiteral("first")));
+    model->item(3)->child(2)->appendRows(items(QStringLiteral("c"), 3));
+    // below a parent without children so far
+    model->item(7)->appendRows(items(QStringLiteral("d"), 4));
+    QTRY_COMPARE(dump(client), dump(model));
+}
+
+void tst_QRemoteModelClient::removeChildren()
+{
+    QStandardItemModel *model = new QStandardItemModel;
+    model->appendColumn(items(QStringLiteral("a"), 10));
+    for (int i = 0; i < 10; i += 2) {
+        model->item(i)->appendRows(items(QStringLiteral("b"), 10));
+        model->item(i)->child(i)->appendRows(items(QStringLiteral("c"), 3));
+    }
+    QVERIFY(serve(model));
+
+    model->item(0)->removeRows(0, 10);
+    model->item(2)->removeRow(2);
+    model->item(4)->child(4)->removeRows(0, 2);
+    QTRY_COMPARE(dump(client), dump(model));
+
+    // the parents go along with their children
+    model->removeRows(5, 4);
+    QTRY_COMPARE(dump(client), dump(model));
+}
+
+// a layout change moves the cached values along with the rows
+void tst_QRemoteModelClient::sort()
+{
+    QStandardItemModel *model = new QStandardItemModel;
+    for (int i = 0; i < 50; i++)
+        model->appendRow(new QStandardItem(QString::number((i * 37) % 50)));
+    for (int i = 0; i < 50; i += 5)
+        model->item(i)->appendRows(items(QString::number(i) + QLatin1Char('-'), 3));
+    QVERIFY(serve(model));
+
+    model->sort(0);
+    QTRY_COMPARE(dump(client), dump(model));
+    model->sort(0, Qt::DescendingOrder);
+    QTRY_COMPARE(dump(client), dump(model));
+    model->item(3)->sortChildren(0, Qt::DescendingOrder);
+    QTRY_COMPARE(dump(client), dump(model));
+}
+
+void tst_QRemoteModelClient::structureChanges_data()
+{
+    QTest::addColumn<int>("rows");
+    QTest::newRow("1000") << 1000;
+    QTest::newRow("10000") << 10000;
+    QTest::newRow("100000") << 100000;
+}
+
+// the time per change should not grow with the number of rows
+void tst_QRemoteModelClient::structureChanges()
+{
+    QFETCH(int, rows);
+    QStringList strings;
+    for (int i = 0; i < rows; i++)
+        strings.append(QString::number(i));
+    QStringListModel *model = new QStringListModel(strings);
+    QVERIFY(serve(model));
+
+    QSignalSpy inserted(client, SIGNAL(rowsInserted(QModelIndex,int,int)));
+    QSignalSpy removed(client, SIGNAL(rowsRemoved(QModelIndex,int,int)));
+    QBENCHMARK {
+        model->insertRow(0);
+        QVERIFY(inserted.wait());
+        model->removeRow(rows / 2);
+        QVERIFY(removed.wait());
+    }
+    QCOMPARE(client->rowCount(), model->rowCount());
+}
+
+QTEST_GUILESS_MAIN(tst_QRemoteModelClient)
+
+#include "tst_qremotemodelclient.moc"
@@ -0,0 +1,9 @@
+CONFIG += testcase
+TARGET = tst_qremotemodelrowindex
+QT = core testlib
+
+# the index is internal to the library and not exported from it
+INCLUDEPATH += $$PWD/../../../src/lib
+HEADERS = $$PWD/../../../src/lib/qremotemodelrowindex_p.h
+SOURCES = tst_qremotemodelrowindex.cpp \
+    $$PWD/../../../src/lib/qremotemodelrowindex.cpp
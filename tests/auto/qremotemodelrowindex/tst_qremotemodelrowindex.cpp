@@ -0,0 +1,387 @@
+/* Copyright (c) 2015 Tasuku Suzuki.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Tasuku Suzuki nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL TASUKU SUZUKI BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtTest/QtTest>
+
+#include "qremotemodelrowindex_p.h"
+
+class Row : public QRemoteModelRowIndex::Item
+{
+public:
+    explicit Row(int value) : value(value) {}
+    int value;
+};
+
+// the index must keep the same rows as a plain vector, where -1 stands
+// for a virtual row
+class tst_QRemoteModelRowIndex : public QObject
+{
+    Q_OBJECT
+private slots:
+    void init();
+    void cleanup();
+
+    void insert();
+    void take();
+    void virtualRows();
+    void splitLeaves();
+    void mergeLeaves();
+    void itemsIntoGaps();
+    void mergeGaps();
+    void randomOperations_data();
+    void randomOperations();
+
+    void insertAtTop_data();
+    void insertAtTop();
+    void positionOf_data();
+    void positionOf();
+
+private:
+    QVector<QRemoteModelRowIndex::Item *> rows(int first, int count);
+    void insert(int position, int count);
+    void take(int position, int count);
+    void insertVirtual(int position, int count);
+    void evict(int position, int count);
+    bool compare() const;
+
+    QRemoteModelRowIndex *index;
+    QVector<int> expected;
+    int nextValue;
+};
+
+void tst_QRemoteModelRowIndex::init()
+{
+    index = new QRemoteModelRowIndex;
+    expected.clear();
+    nextValue = 0;
+}
+
+void tst_QRemoteModelRowIndex::cleanup()
+{
+    foreach (QRemoteModelRowIndex::Item *item, index->take(0, index->count()))
+        delete static_cast<Row *>(item);
+    delete index;
+}
+
+QVector<QRemoteModelRowIndex::Item *> tst_QRemoteModelRowIndex::rows(int first, int count)
+{
+    QVector<QRemoteModelRowIndex::Item *> ret;
+    for (int i = 0; i < count; i++)
+        ret.append(new Row(first + i));
+    return ret;
+}
+
+void tst_QRemoteModelRowIndex::insert(int position, int count)
+{
+    index->insert(position, rows(nextValue, count));
+    for (int i = 0; i < count; i++)
+        expected.insert(position + i, nextValue++);
+}
+
+void tst_QRemoteModelRowIndex::take(int position, int count)
+{
+    QVector<QRemoteModelRowIndex::Item *> taken = index->take(position, count);
+    QVector<int> values;
+    foreach (QRemoteModelRowIndex::Item *item, taken) {
+        values.append(static_cast<Row *>(item)->value);
+        QCOMPARE(index->positionOf(item), -1);
+        delete static_cast<Row *>(item);
+    }
+    QVector<int> removed = expected.mid(position, count);
+    removed.removeAll(-1);
+    QCOMPARE(values, removed);
+    expected.remove(position, count);
+}
+
+void tst_QRemoteModelRowIndex::insertVirtual(int position, int count)
+{
+    index->insertVirtual(position, count);
+    expected.insert(position, count, -1);
+}
+
+void tst_QRemoteModelRowIndex::evict(int position, int count)
+{
+    QVector<QRemoteModelRowIndex::Item *> evicted = index->evict(position, count);
+    QVector<int> values;
+    foreach (QRemoteModelRowIndex::Item *item, evicted) {
+        values.append(static_cast<Row *>(item)->value);
+        delete static_cast<Row *>(item);
+    }
+    QVector<int> removed = expected.mid(position, count);
+    removed.removeAll(-1);
+    QCOMPARE(values, removed);
+    for (int i = position; i < position + count; i++)
+        expected[i] = -1;
+}
+
+bool tst_QRemoteModelRowIndex::compare() const
+{
+    if (!index->check() || index->count() != expected.count())
+        return false;
+    QVector<QRemoteModelRowIndex::Item *> all = index->mid(0, index->count());
+    QVector<int> positions;
+    QVector<QRemoteModelRowIndex::Item *> items = index->items(0, index->count(), &positions);
+    int j = 0;
+    for (int i = 0; i < expected.count(); i++) {
+        QRemoteModelRowIndex::Item *item = all.at(i);
+        if (expected.at(i) < 0) {
+            if (item || index->at(i))
+                return false;
+            continue;
+        }
+        if (!item || static_cast<Row *>(item)->value != expected.at(i) || index->at(i) != item)
+            return false;
+        if (index->positionOf(item) != i)
+            return false;
+        if (j >= items.count() || items.at(j) != item || positions.at(j) != i)
+            return false;
+        j++;
+    }
+    return j == items.count();
+}
+
+void tst_QRemoteModelRowIndex::insert()
+{
+    insert(0, 1);
+    QVERIFY(compare());
+    insert(0, 1);
+    insert(2, 1);
+    insert(1, 300);
+    QVERIFY(compare());
+    for (int i = 0; i < 200; i++)
+        insert(expected.count() / 2, 1);
+    QVERIFY(compare());
+}
+
+void tst_QRemoteModelRowIndex::take()
+{
+    insert(0, 1000);
+    take(0, 1);
+    take(expected.count() - 1, 1);
+    QVERIFY(compare());
+    take(100, 500);
+    QVERIFY(compare());
+    while (expected.count() > 10)
+        take(expected.count() / 3, 7);
+    QVERIFY(compare());
+    take(0, expected.count());
+    QVERIFY(compare());
+    QVERIFY(index->isEmpty());
+    // takes past the end stop there
+    insert(0, 10);
+    take(5, 100);
+    QVERIFY(compare());
+}
+
+void tst_QRemoteModelRowIndex::virtualRows()
+{
+    insertVirtual(0, 1000);
+    QVERIFY(compare());
+    insert(500, 3);
+    insert(0, 2);
+    insert(expected.count(), 2);
+    QVERIFY(compare());
+    evict(0, 10);
+    QVERIFY(compare());
+    take(400, 300);
+    QVERIFY(compare());
+    take(0, expected.count());
+    QVERIFY(compare());
+    QVERIFY(index->isEmpty());
+}
+
+// a leaf holds 64 rows and a branch 32 blocks, so these grow the tree
+// by more than one level
+void tst_QRemoteModelRowIndex::splitLeaves()
+{
+    for (int i = 0; i < 64 * 40; i++)
+        insert(0, 1);
+    QVERIFY(compare());
+    for (int i = 0; i < 64 * 40; i++)
+        insert(expected.count() / 2, 1);
+    QVERIFY(compare());
+    insert(100, 64 * 32 + 1);
+    QVERIFY(compare());
+}
+
+void tst_QRemoteModelRowIndex::mergeLeaves()
+{
+    insert(0, 64 * 64);
+    // thin out every leaf below the merge threshold
+    for (int position = 0; position < expected.count(); position += 4)
+        take(position, qMin(60, expected.count() - position));
+    QVERIFY(compare());
+    while (expected.count() > 1)
+        take(expected.count() / 2, 1);
+    QVERIFY(compare());
+    take(0, 1);
+    QVERIFY(compare());
+    QVERIFY(index->isEmpty());
+}
+
+// items going into a gap split it, or join the leaf in front of it
+void tst_QRemoteModelRowIndex::itemsIntoGaps()
+{
+    insertVirtual(0, 100);
+    insert(50, 1);
+    QVERIFY(compare());
+    // right behind the new items, at the start of the rest of the gap
+    insert(51, 2);
+    // at the very start of the gap
+    insert(0, 1);
+    // at the very end of the gap
+    insert(expected.count(), 1);
+    QVERIFY(compare());
+    insertVirtual(10, 5);
+    insert(12, 70);
+    QVERIFY(compare());
+}
+
+// adjacent gaps fold into one, from either side
+void tst_QRemoteModelRowIndex::mergeGaps()
+{
+    insert(0, 10);
+    insertVirtual(5, 100);
+    insertVirtual(5, 10);
+    insertVirtual(115, 10);
+    QVERIFY(compare());
+    // evicting the items between two gaps joins them
+    insertVirtual(0, 20);
+    evict(20, 5);
+    QVERIFY(compare());
+    evict(0, expected.count());
+    QVERIFY(compare());
+    insert(expected.count() / 2, 1);
+    take(0, expected.count());
+    QVERIFY(compare());
+    QVERIFY(index->isEmpty());
+}
+
+void tst_QRemoteModelRowIndex::randomOperations_data()
+{
+    QTest::addColumn<quint32>("seed");
+    for (quint32 seed = 1; seed <= 8; seed++)
+        QTest::newRow(QByteArray::number(seed).constData()) << seed;
+}
+
+void tst_QRemoteModelRowIndex::randomOperations()
+{
+    QFETCH(quint32, seed);
+    QRandomGenerator random(seed);
+    for (int i = 0; i < 2000; i++) {
+        int position = random.bounded(expected.count() + 1);
+        int rest = expected.count() - position;
+        int count = 1 + random.bounded(random.bounded(2) ? 4 : 200);
+        switch (random.bounded(4)) {
+        case 0:
+        case 1:
+            insert(position, count);
+            break;
+        case 2:
+            if (random.bounded(2))
+                insertVirtual(position, count);
+            else if (rest > 0)
+                evict(position, qMin(count, rest));
+            break;
+        case 3:
+            if (rest > 0)
+                take(position, qMin(count, rest));
+            break;
+        }
+        if (QTest::currentTestFailed())
+            return;
+        if (i % 50 == 0)
+            QVERIFY2(compare(), qPrintable(QStringLiteral("after %1 operations").arg(i + 1)));
+    }
+    QVERIFY(compare());
+}
+
+// against the list of children the client kept before
+void tst_QRemoteModelRowIndex::insertAtTop_data()
+{
+    QTest::addColumn<int>("rows");
+    QTest::addColumn<bool>("list");
+    foreach (int rows, QList<int>() << 10000 << 100000 << 1000000) {
+        QTest::newRow(qPrintable(QStringLiteral("index %1").arg(rows))) << rows << false;
+        QTest::newRow(qPrintable(QStringLiteral("QList %1").arg(rows))) << rows << true;
+    }
+}
+
+void tst_QRemoteModelRowIndex::insertAtTop()
+{
+    QFETCH(int, rows);
+    QFETCH(bool, list);
+    Row row(-1);
+    if (list) {
+        QList<Row *> children;
+        for (int i = 0; i < rows; i++)
+            children.append(new Row(i));
+        QBENCHMARK {
+            children.insert(0, &row);
+            children.removeFirst();
+        }
+        qDeleteAll(children);
+    } else {
+        insert(0, rows);
+        QBENCHMARK {
+            index->insert(0, &row);
+            index->take(0, 1);
+        }
+    }
+}
+
+void tst_QRemoteModelRowIndex::positionOf_data()
+{
+    insertAtTop_data();
+}
+
+void tst_QRemoteModelRowIndex::positionOf()
+{
+    QFETCH(int, rows);
+    QFETCH(bool, list);
+    int position = -1;
+    if (list) {
+        QList<Row *> children;
+        for (int i = 0; i < rows; i++)
+            children.append(new Row(i));
+        Row *row = children.at(rows / 2);
+        QBENCHMARK {
+            position = children.indexOf(row);
+        }
+        qDeleteAll(children);
+    } else {
+        insert(0, rows);
+        QRemoteModelRowIndex::Item *row = index->at(rows / 2);
+        QBENCHMARK {
+            position = index->positionOf(row);
+        }
+    }
+    QCOMPARE(position, rows / 2);
+}
+
+QTEST_APPLESS_MAIN(tst_QRemoteModelRowIndex)
+
+#include "tst_qremotemodelrowindex.moc"
@@ -0,0 +1,5 @@
+CONFIG += testcase
+TARGET = tst_qremotemodelserver
+QT = core network testlib remotemodel
+
+SOURCES = tst_qremotemodelserver.cpp
@@ -0,0 +1,95 @@
+/* Copyright (c) 2015 Tasuku Suzuki.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Tasuku Suzuki nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL TASUKU SUZUKI BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtTest/QtTest>
+#include <QtCore/QStringListModel>
+
+#include <QtRemoteModel/QRemoteModelServer>
+#include <QtRemoteModel/QRemoteModelClient>
+
+class tst_QRemoteModelServer : public QObject
+{
+    Q_OBJECT
+private slots:
+    void broadcast_data();
+    void broadcast();
+};
+
+void tst_QRemoteModelServer::broadcast_data()
+{
+    QTest::addColumn<int>("clients");
+    foreach (int clients, QList<int>() << 1 << 4 << 16 << 64)
+        QTest::newRow(QByteArray::number(clients).constData()) << clients;
+}
+
+// one value change, until every local client has it; the cost should
+// grow with the clients only by what each of them reads
+void tst_QRemoteModelServer::broadcast()
+{
+    QFETCH(int, clients);
+    QStringList strings;
+    for (int i = 0; i < 1000; i++)
+        strings.append(QString::number(i));
+    QStringListModel model(strings);
+    QRemoteModelServer server;
+    server.setModel(&model);
+    server.setPushValues(true);
+    QString name = QStringLiteral("tst_qremotemodelserver-%1-%2").arg(QCoreApplication::applicationPid()).arg(clients);
+    QVERIFY(server.listen(name));
+
+    // the clients go before what their connections refer to
+    int changes = 0;
+    QEventLoop loop;
+    QObject owner;
+    QList<QRemoteModelClient *> mirrors;
+    for (int i = 0; i < clients; i++) {
+        QRemoteModelClient *client = new QRemoteModelClient(&owner);
+        client->connectToServer(name);
+        connect(client, &QRemoteModelClient::dataChanged, [&changes, &loop, clients]() {
+            if (++changes == clients)
+                loop.quit();
+        });
+        mirrors.append(client);
+    }
+    foreach (QRemoteModelClient *client, mirrors)
+        QTRY_COMPARE(client->rowCount(), model.rowCount());
+
+    QTimer timeout;
+    timeout.setSingleShot(true);
+    connect(&timeout, &QTimer::timeout, &loop, &QEventLoop::quit);
+    int value = 0;
+    QBENCHMARK {
+        changes = 0;
+        model.setData(model.index(500), QString::number(++value));
+        timeout.start(5000);
+        loop.exec();
+        QCOMPARE(changes, clients);
+    }
+}
+
+QTEST_GUILESS_MAIN(tst_QRemoteModelServer)
+
+#include "tst_qremotemodelserver.moc"